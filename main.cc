@@ -7,10 +7,35 @@
 
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <vector>
-#include <set>
+#include <cstdio>
+#include <unordered_set>
 #include <cstring>
 #include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sstream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 #define IS_VALID(x)                     \
@@ -21,305 +46,7238 @@
 #define DEBUG_PARSE      0
 #define DEBUG_PROCESS    0
 
+// use '-DBYTE_ALPHABET=1' to accept any byte in the words (instead of 'a' to 'z')
+#ifndef BYTE_ALPHABET
+#define BYTE_ALPHABET    0
+#endif
+
 
 using namespace std;
 
 
 /**
- * This class represents a node of the graph. The final graph resembles
- * a Deterministic Finite Automata (DFA).
+ * Bump allocator for plain objects stored contiguously and referenced by index.
+ *
+ * The arena maps a large anonymous region upfront (pages are only committed by
+ * the kernel when touched) and new objects are taken from its end, so the
+ * allocation is a pointer bump and the memory starts zero-filled. When the
+ * region is full it is remapped with twice the size, which moves pages instead
+ * of copying them. Releasing the arena unmaps the whole region at once.
+ *
+ * An arena can also wrap memory owned by someone else (e.g. a read-only mapping
+ * of a file), in which case no objects can be allocated.
+ */
+template<typename T> class Arena
+{
+    public:
+        Arena();
+
+        ~Arena();
+
+        /**
+         * @brief Allocates @c count zero-filled objects at the end of the arena
+         * and returns the index of the first one.
+         */
+        size_t allocate(
+            size_t count );
+
+        /**
+         * @brief Releases the current objects and uses the given memory, which
+         * contains @c count objects and is not owned by the arena.
+         */
+        void wrap(
+            T *memory,
+            size_t count );
+
+        T &operator[](
+            size_t index )
+        {
+            return data[index];
+        }
+
+        const T &operator[](
+            size_t index ) const
+        {
+            return data[index];
+        }
+
+        /**
+         * @brief Returns the number of allocated objects.
+         */
+        size_t size() const
+        {
+            return used;
+        }
+
+        /**
+         * @brief Returns the number of bytes used by the allocated objects.
+         */
+        size_t memory() const
+        {
+            return used * sizeof(T);
+        }
+
+        /**
+         * @brief Returns a pointer to the first object.
+         */
+        const T *begin() const
+        {
+            return data;
+        }
+
+    private:
+        /**
+         * @brief Initial size of the mapped region in bytes.
+         */
+        static const size_t RESERVE = (size_t) 64 << 20;
+
+        T *data;
+
+        size_t used;
+
+        size_t capacity;
+
+        /**
+         * @brief Indicates if the memory was mapped by the arena.
+         */
+        bool owned;
+
+        Arena(
+            const Arena & );
+
+        Arena &operator=(
+            const Arena & );
+};
+
+
+// std::max takes its arguments by reference, so the constant needs a definition
+template<typename T> const size_t Arena<T>::RESERVE;
+
+
+template<typename T> Arena<T>::Arena() : data(NULL), used(0), capacity(0), owned(true)
+{
+}
+
+
+template<typename T> Arena<T>::~Arena()
+{
+    if (data != NULL && owned) munmap(data, capacity * sizeof(T));
+}
+
+
+template<typename T> void Arena<T>::wrap(
+    T *memory,
+    size_t count )
+{
+    if (data != NULL && owned) munmap(data, capacity * sizeof(T));
+
+    data = memory;
+    used = capacity = count;
+    owned = false;
+}
+
+
+template<typename T> size_t Arena<T>::allocate(
+    size_t count )
+{
+    if (used + count > capacity)
+    {
+        if (!owned)
+        {
+            std::cerr << "Can not change a read-only graph" << std::endl;
+            abort();
+        }
+
+        size_t bytes = std::max(capacity * sizeof(T) * 2, RESERVE);
+        while (bytes < (used + count) * sizeof(T)) bytes *= 2;
+
+        void *region;
+        if (data == NULL)
+            region = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        else
+        {
+            #ifdef MREMAP_MAYMOVE
+            region = mremap(data, capacity * sizeof(T), bytes, MREMAP_MAYMOVE);
+            #else
+            region = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (region != MAP_FAILED)
+            {
+                memcpy(region, data, used * sizeof(T));
+                munmap(data, capacity * sizeof(T));
+            }
+            #endif
+        }
+        if (region == MAP_FAILED)
+        {
+            std::cerr << "Can not allocate " << bytes << " bytes for the graph" << std::endl;
+            abort();
+        }
+
+        data = (T*) region;
+        capacity = bytes / sizeof(T);
+    }
+
+    size_t index = used;
+    used += count;
+    return index;
+}
+
+
+/**
+ * Part of a word (e.g. a sub-word of a compound word).
+ */
+struct Span
+{
+    uint32_t offset;
+
+    uint32_t length;
+};
+
+
+/**
+ * Counters of the work done while checking words.
+ */
+struct Counters
+{
+    /**
+     * @brief Number of transitions between nodes.
+     */
+    uint64_t steps;
+
+    /**
+     * @brief Number of times the search started from the root (once for each
+     * position which can start a sub-word).
+     */
+    uint64_t restarts;
+
+    /**
+     * @brief Number of words rejected by the prefilter.
+     */
+    uint64_t filtered;
+
+    Counters() : steps(0), restarts(0), filtered(0)
+    {
+    }
+
+    Counters &operator+=(
+        const Counters &other )
+    {
+        steps += other.steps;
+        restarts += other.restarts;
+        filtered += other.filtered;
+        return *this;
+    }
+};
+
+
+/**
+ * @brief Converts the uppercase letters of the given text to lowercase (in
+ * place) up to the first line break and returns the position of the line break
+ * (or @c length if there is none). The position of the first character which
+ * is not a letter is stored in @c invalid (the returned value if there is none).
+ *
+ * The text is processed in blocks of 32 (AVX2) or 16 (SSE2) bytes, so letters
+ * after the line break in the same block may also be converted. Blocks without
+ * uppercase letters are never written.
+ */
+size_t normalizeLine(
+    char *text,
+    size_t length,
+    size_t &invalid )
+{
+    size_t i = 0;
+    invalid = (size_t) -1;
+
+    #if defined(__AVX2__) || defined(__SSE2__)
+
+    #if defined(__AVX2__)
+    typedef __m256i Block;
+    #define BLOCK_SET      _mm256_set1_epi8
+    #define BLOCK_LOAD(x)  _mm256_loadu_si256( (const __m256i*) (x) )
+    #define BLOCK_STORE    _mm256_storeu_si256
+    #define BLOCK_OR       _mm256_or_si256
+    #define BLOCK_AND      _mm256_and_si256
+    #define BLOCK_ADD      _mm256_add_epi8
+    #define BLOCK_EQUAL    _mm256_cmpeq_epi8
+    #define BLOCK_GREATER  _mm256_cmpgt_epi8
+    #define BLOCK_MASK(x)  (uint32_t) _mm256_movemask_epi8(x)
+    #else
+    typedef __m128i Block;
+    #define BLOCK_SET      _mm_set1_epi8
+    #define BLOCK_LOAD(x)  _mm_loadu_si128( (const __m128i*) (x) )
+    #define BLOCK_STORE    _mm_storeu_si128
+    #define BLOCK_OR       _mm_or_si128
+    #define BLOCK_AND      _mm_and_si128
+    #define BLOCK_ADD      _mm_add_epi8
+    #define BLOCK_EQUAL    _mm_cmpeq_epi8
+    #define BLOCK_GREATER  _mm_cmpgt_epi8
+    #define BLOCK_MASK(x)  (uint32_t) _mm_movemask_epi8(x)
+    #endif
+
+    const Block lineBreak = BLOCK_SET('\n');
+    const Block caseBit = BLOCK_SET(0x20);
+    const Block zero = BLOCK_SET(0);
+    // after setting the case bit and adding this value, the letters are the
+    // only characters in the range [-128, -103]
+    const Block shift = BLOCK_SET( (char) (0x80 - 'a') );
+    const Block bound = BLOCK_SET( (char) (0x80 + 26) );
+
+    for (; i + sizeof(Block) <= length; i += sizeof(Block))
+    {
+        Block block = BLOCK_LOAD(text + i);
+        Block letters = BLOCK_GREATER(bound, BLOCK_ADD(BLOCK_OR(block, caseBit), shift));
+        Block upper = BLOCK_AND(letters, BLOCK_EQUAL(BLOCK_AND(block, caseBit), zero));
+        if (BLOCK_MASK(upper) != 0)
+            BLOCK_STORE((Block*) (text + i), BLOCK_OR(block, BLOCK_AND(upper, caseBit)));
+
+        uint32_t breaks = BLOCK_MASK(BLOCK_EQUAL(block, lineBreak));
+        uint32_t others = ~BLOCK_MASK(letters) & (uint32_t) ((1ULL << sizeof(Block)) - 1);
+        // only the characters before the first line break matter
+        if (breaks != 0) others &= (breaks & -breaks) - 1;
+        if (others != 0 && invalid == (size_t) -1) invalid = i + (size_t) __builtin_ctz(others);
+        if (breaks != 0)
+        {
+            i += (size_t) __builtin_ctz(breaks);
+            if (invalid > i) invalid = i;
+            return i;
+        }
+    }
+
+    #undef BLOCK_SET
+    #undef BLOCK_LOAD
+    #undef BLOCK_STORE
+    #undef BLOCK_OR
+    #undef BLOCK_AND
+    #undef BLOCK_ADD
+    #undef BLOCK_EQUAL
+    #undef BLOCK_GREATER
+    #undef BLOCK_MASK
+
+    #endif
+
+    for (; i < length && text[i] != '\n'; ++i)
+    {
+        char current = text[i];
+        if (!IS_VALID(current))
+        {
+            if (invalid == (size_t) -1) invalid = i;
+        }
+        else
+        if (current < 'a')
+            text[i] = (char) (current + 32);
+    }
+    if (invalid > i) invalid = i;
+    return i;
+}
+
+
+/**
+ * Alphabet of the graph: the lowercase letters from 'a' to 'z'.
+ *
+ * Each alphabet gives the number of symbols, maps characters to symbols (the
+ * value SIZE means the character is not in the alphabet) and back, and
+ * normalizes the lines of the input (see @c normalizeLine).
+ */
+struct Letters
+{
+    static const uint32_t SIZE = 26;
+
+    static uint32_t symbol(
+        unsigned char character )
+    {
+        uint32_t result = (uint32_t) character - 'a';
+        return (result < SIZE) ? result : SIZE;
+    }
+
+    static char character(
+        uint32_t symbol )
+    {
+        return (char) ('a' + symbol);
+    }
+
+    static size_t normalize(
+        char *text,
+        size_t length,
+        size_t &invalid )
+    {
+        return normalizeLine(text, length, invalid);
+    }
+};
+
+
+/**
+ * Alphabet of the graph: every byte, so words may contain digits, punctuation
+ * or UTF-8 sequences. Lines are used as they are (no case conversion).
+ */
+struct Bytes
+{
+    static const uint32_t SIZE = 256;
+
+    static uint32_t symbol(
+        unsigned char character )
+    {
+        return character;
+    }
+
+    static char character(
+        uint32_t symbol )
+    {
+        return (char) symbol;
+    }
+
+    static size_t normalize(
+        char *text,
+        size_t length,
+        size_t &invalid )
+    {
+        const char *limit = (const char*) memchr(text, '\n', length);
+        invalid = (limit == NULL) ? length : (size_t) (limit - text);
+        return invalid;
+    }
+};
+
+
+#if (BYTE_ALPHABET == 1)
+typedef Bytes Alphabet;
+#else
+typedef Letters Alphabet;
+#endif
+
+
+/**
+ * Cheap checks which reject most of the words which can not be compound before
+ * walking the graph: the length of the word, its first and last characters and
+ * a Bloom filter with the words of the graph, used to find if some suffix of
+ * the word may be a word. A rejected word is never compound, but an accepted
+ * word may not be.
+ *
+ * Prefixes are not checked with the Bloom filter, since walking the graph from
+ * the root finds them as fast.
+ */
+class Prefilter
+{
+    public:
+        Prefilter();
+
+        /**
+         * @brief Removes every word and sizes the Bloom filter for the given
+         * number of words.
+         */
+        void reset(
+            size_t count );
+
+        /**
+         * @brief Includes a word of the graph in the filter.
+         */
+        void add(
+            const char *word,
+            size_t length );
+
+        /**
+         * @brief Returns @c false if the given word can not be made up of two
+         * or more words included in the filter.
+         */
+        bool accepts(
+            const char *word,
+            size_t length ) const;
+
+        bool empty() const
+        {
+            return bits.empty();
+        }
+
+        size_t memory() const
+        {
+            return bits.size() * sizeof(uint64_t);
+        }
+
+    private:
+        static const uint64_t SEED = 0xCBF29CE484222325ULL;
+
+        vector<uint64_t> bits;
+
+        /**
+         * @brief Number of bits of the Bloom filter minus one.
+         */
+        uint64_t mask;
+
+        /**
+         * @brief Length of the shortest word.
+         */
+        size_t minimum;
+
+        /**
+         * @brief Bitsets of the first and last characters of the words.
+         */
+        uint64_t firsts[4];
+
+        uint64_t lasts[4];
+
+        static uint64_t mix(
+            uint64_t hash,
+            char character )
+        {
+            return (hash ^ (unsigned char) character) * 0x100000001B3ULL;
+        }
+
+        void insert(
+            uint64_t hash );
+
+        bool contains(
+            uint64_t hash ) const;
+};
+
+
+Prefilter::Prefilter() : mask(0), minimum(0)
+{
+    memset(firsts, 0, sizeof(firsts));
+    memset(lasts, 0, sizeof(lasts));
+}
+
+
+void Prefilter::reset(
+    size_t count )
+{
+    // 8 to 16 bits per word, for a false positive rate below 5% with two
+    // probes (a small filter stays in the cache)
+    size_t size = 64;
+    while (size < count * 8) size *= 2;
+    vector<uint64_t>(size / 64, 0).swap(bits);
+    mask = size - 1;
+    minimum = (size_t) -1;
+    memset(firsts, 0, sizeof(firsts));
+    memset(lasts, 0, sizeof(lasts));
+}
+
+
+inline void Prefilter::insert(
+    uint64_t hash )
+{
+    hash ^= hash >> 29;
+    uint64_t first = hash & mask;
+    uint64_t second = (hash >> 32) & mask;
+    bits[first / 64] |= 1ULL << (first % 64);
+    bits[second / 64] |= 1ULL << (second % 64);
+}
+
+
+inline bool Prefilter::contains(
+    uint64_t hash ) const
+{
+    hash ^= hash >> 29;
+    uint64_t first = hash & mask;
+    uint64_t second = (hash >> 32) & mask;
+    return (bits[first / 64] & (1ULL << (first % 64))) != 0 &&
+        (bits[second / 64] & (1ULL << (second % 64))) != 0;
+}
+
+
+void Prefilter::add(
+    const char *word,
+    size_t length )
+{
+    if (length == 0) return;
+
+    // the words are hashed backward, so the hashes of the suffixes of a word
+    // are found in a single pass
+    uint64_t hash = SEED;
+    for (size_t i = length; i-- > 0; )
+        hash = mix(hash, word[i]);
+    insert(hash);
+
+    unsigned char first = (unsigned char) word[0];
+    unsigned char last = (unsigned char) word[length - 1];
+    firsts[first / 64] |= 1ULL << (first % 64);
+    lasts[last / 64] |= 1ULL << (last % 64);
+    if (length < minimum) minimum = length;
+}
+
+
+bool Prefilter::accepts(
+    const char *word,
+    size_t length ) const
+{
+    if (length < minimum * 2) return false;
+
+    unsigned char first = (unsigned char) word[0];
+    unsigned char last = (unsigned char) word[length - 1];
+    if ((firsts[first / 64] & (1ULL << (first % 64))) == 0 ||
+        (lasts[last / 64] & (1ULL << (last % 64))) == 0) return false;
+
+    // some proper suffix must be a word, with room for another one before it
+    uint64_t hash = SEED;
+    for (size_t i = 0, limit = length - minimum; i < limit; ++i)
+    {
+        hash = mix(hash, word[length - 1 - i]);
+        if (i + 1 >= minimum && contains(hash)) return true;
+    }
+    return false;
+}
+
+
+/**
+ * This class represents the graph. The final graph resembles a Deterministic
+ * Finite Automata (DFA).
+ *
+ * Nodes are stored in a flat pool and referenced by 32-bit indices (the root is
+ * always the node 0). Each node keeps a bitmap with one bit per symbol of the
+ * alphabet (by default 'a' to 'z', see @c Alphabet) and the position of its
+ * children in the edge pool, where the indices of the 'next' nodes are stored
+ * contiguously in alphabetical order.
+ * The index of the child for a character is found by counting the bits set
+ * before the character in the bitmap. Both pools are arenas owned by the graph,
+ * so building it does not allocate nodes individually and destroying it only
+ * releases the arenas.
+ *
+ * The graph can be built as a plain prefix tree (with @c parse) or, when the
+ * words are given in lexicographic order, as a minimal acyclic automaton (with
+ * @c append) where equivalent suffixes share the same nodes.
+ */
+class Graph
+{
+    public:
+        Graph();
+
+        ~Graph();
+
+        /**
+         * @brief Build the graph
+         */
+        void parse(
+            const string &value );
+
+        /**
+         * @brief Build the graph
+         */
+        void parse(
+            const char *value,
+            size_t length );
+
+        /**
+         * @brief Returns a boolean value indicating if the given word is in the
+         * graph.
+         */
+        bool contains(
+            const char *value,
+            size_t length ) const;
+
+        /**
+         * @brief Removes a word from the graph, releasing its nodes which are
+         * not used by other words. Returns @c false if the word is not in the
+         * graph. The graph must be editable (see @c isEditable).
+         */
+        bool remove(
+            const char *value,
+            size_t length );
+
+        /**
+         * @brief Returns a boolean value indicating if words can be added (with
+         * @c parse) and removed (with @c remove) after the graph is built. Only
+         * prefix trees built with @c parse, without links or prefilter, are
+         * editable (graphs loaded from files are read-only).
+         */
+        bool isEditable() const;
+
+        /**
+         * @brief Build the graph as a minimal acyclic automaton (DAWG).
+         *
+         * Words must be given in lexicographic order and @c finish must be called
+         * after the last one. Nodes of the previous word which are not shared
+         * with the current one can not change anymore, so they are replaced by
+         * equivalent nodes (same terminal flag and same 'next' nodes) already in
+         * the graph. A graph built this way must not be changed with @c parse.
+         */
+        void append(
+            const char *value,
+            size_t length );
+
+        /**
+         * @brief Minimizes the nodes of the last word given to @c append.
+         */
+        void finish();
+
+        /**
+         * @brief Copies every node of @c other to this graph (relocating their
+         * indices) and links the 'next' nodes of its root to the root of this
+         * graph, which must not have 'next' nodes for the same characters.
+         *
+         * This allows building the subtrees of the root separately (e.g. one
+         * per thread) and joining them at the end.
+         */
+        void merge(
+            const Graph &other );
+
+        /**
+         * @brief Returns a boolean value indicating if the given word is made up
+         * of words in the graph.
+         */
+        bool isCompoundWord(
+            const string &word ) const;
+
+        /**
+         * @brief Returns a boolean value indicating if the given word is made up
+         * of words in the graph.
+         *
+         * This function segments the given word using dynamic programming: for
+         * each position it records whether the characters before it can be split
+         * into sub-words of the graph, so every position is expanded (walked
+         * from the root) at most once. The return value is @c true only if the
+         * whole word can be split into at least two sub-words in the list.
+         *
+         * If @c counters is not NULL, the work done is added to it.
+         */
+        bool isCompoundWord(
+            const char *word,
+            size_t length,
+            Counters *counters = NULL ) const;
+
+        /**
+         * @brief Checks a batch of words as @c isCompoundWord, storing in
+         * @c results whether each word is compound.
+         *
+         * The words are walked in lockstep, a few at a time: each step of a word
+         * prefetches the memory needed by its next step and moves on to the
+         * other words, so the cache misses of different words overlap instead
+         * of stalling on each one. Graphs with links or a double array are
+         * checked one word at a time.
+         */
+        void isCompoundWords(
+            const char * const *words,
+            const size_t *lengths,
+            size_t count,
+            bool *results,
+            Counters *counters = NULL ) const;
+
+        /**
+         * @brief Finds the sub-words which the given word is made up of.
+         *
+         * The sub-words are stored in order in @c parts as positions in the
+         * given word (nothing is copied, so reusing @c parts avoids allocating
+         * memory). Returns @c false if the word is not compound.
+         */
+        bool split(
+            const char *word,
+            size_t length,
+            vector<Span> &parts,
+            Counters *counters = NULL ) const;
+
+        /**
+         * @brief Finds every way the given word can be split in sub-words (at
+         * most @c limit of them), in lexicographic order of the positions.
+         * Returns the number of splits found.
+         */
+        size_t splitAll(
+            const char *word,
+            size_t length,
+            vector< vector<Span> > &splits,
+            size_t limit ) const;
+
+        /**
+         * @brief Finds every word of the graph in the given text, storing them
+         * in @c matches ordered by position and then by length.
+         */
+        void findWords(
+            const char *text,
+            size_t length,
+            vector<Span> &matches ) const;
+
+        /**
+         * @brief Adds failure and output links to the graph (as in the
+         * Aho-Corasick algorithm), so @c isCompoundWord and @c split find every
+         * sub-word ending at each position of the word in a single pass over it,
+         * instead of walking from the root at each position which can start a
+         * sub-word.
+         *
+         * Only a prefix tree can have links, since the nodes of a minimal
+         * automaton are reached by more than one prefix. Returns @c false for
+         * such graphs. The graph must not be changed after this.
+         */
+        bool buildLinks();
+
+        /**
+         * @brief Builds a prefilter with the words of the graph, so words which
+         * can not be compound are rejected before walking the graph (see
+         * @c Prefilter). The graph must not be changed after this.
+         */
+        void buildFilter();
+
+        /**
+         * @brief Builds a double-array (base and check) copy of the graph, used
+         * by @c isCompoundWord and @c split from then on. A transition is then
+         * a single read of a contiguous array, instead of reading the node, its
+         * bitmap and its edge block.
+         *
+         * Only a prefix tree can be stored, since each cell is reached by a
+         * single transition. Returns @c false for other graphs. The graph must
+         * not be changed after this.
+         */
+        bool buildDoubleArray();
+
+        /**
+         * @brief Writes the graph to a binary file which can be used later
+         * with @c load.
+         */
+        bool save(
+            const string &fileName ) const;
+
+        /**
+         * @brief Replaces the graph with the one stored in the given file. The
+         * file is mapped in memory, so the graph is ready almost immediately,
+         * but it becomes read-only. Files which are not a valid graph (e.g.
+         * truncated or corrupted) are rejected and the graph is not changed.
+         */
+        bool load(
+            const string &fileName );
+
+        /**
+         * @brief Appends every word in the graph (in lexicographic order) to the
+         * given text, one per line.
+         */
+        void enumerate(
+            string &text ) const;
+
+        /**
+         * @brief Calls @c visitor for every word in the graph (in lexicographic
+         * order) starting with the given prefix.
+         */
+        template<typename Visitor> void enumerate(
+            const char *prefix,
+            size_t length,
+            Visitor &visitor ) const;
+
+        /**
+         * @brief Calls @c visitor for every word in the graph (in lexicographic
+         * order) containing the given pattern.
+         *
+         * Every node of the graph is visited once, keeping for each prefix how
+         * much of the pattern it matches (as in the Knuth-Morris-Pratt
+         * algorithm).
+         */
+        template<typename Visitor> void enumerateContaining(
+            const char *pattern,
+            size_t length,
+            Visitor &visitor ) const;
+
+        /**
+         * @brief Finds the longest compound word in the graph starting with the
+         * given prefix. Returns @c false if there is no such word.
+         */
+        bool longestCompoundWord(
+            const char *prefix,
+            size_t length,
+            string &result ) const;
+
+        /**
+         * @brief Calls @c visitor for every word in the graph (in lexicographic
+         * order) whose first character index is in the range [first, last],
+         * indicating if the word is made up of other words in the graph.
+         *
+         * The words are enumerated by a depth-first walk which checks every
+         * word during the walk itself. For each prefix in the path, it keeps the
+         * nodes reached by the sub-words which may start after some split of
+         * the prefix, so the work done for a prefix is shared by every word
+         * starting with it. If @c counters is not NULL, the work done is added
+         * to it.
+         */
+        template<typename Visitor> void scan(
+            uint32_t first,
+            uint32_t last,
+            Visitor &visitor,
+            Counters *counters = NULL ) const;
+
+        /**
+         * @brief Returns the number of nodes in the graph.
+         */
+        size_t size() const;
+
+        /**
+         * @brief Returns the number of bytes allocated by the graph.
+         */
+        size_t memory() const;
+
+    private:
+        /**
+         * @brief Number of 32-bit words in the node bitmap (one bit for each
+         * symbol of the alphabet, plus the terminal flag).
+         */
+        static const uint32_t WORDS = Alphabet::SIZE / 32 + 1;
+
+        /**
+         * @brief Indicates in the last word of the node bitmap if the node is a
+         * terminal.
+         */
+        static const uint32_t TERMINAL = 0x80000000;
+
+        /**
+         * @brief Mask for the bits of the last word of the node bitmap which
+         * indicates if the node has a 'next' node for each symbol.
+         */
+        static const uint32_t CHILDREN = (1U << (Alphabet::SIZE % 32)) - 1;
+
+        /**
+         * @brief Index used when there is no 'next' node.
+         */
+        static const uint32_t NIL = 0;
+
+        /**
+         * @brief Position used to terminate the lists of unused edge blocks.
+         */
+        static const uint32_t NONE = 0xFFFFFFFF;
+
+        struct Node
+        {
+            /**
+             * @brief Bitmap of existing 'next' nodes and the terminal flag.
+             */
+            uint32_t flags[WORDS];
+
+            /**
+             * @brief Position in the edge pool of the first 'next' node.
+             */
+            uint32_t edges;
+
+            bool isTerminal() const
+            {
+                return (flags[WORDS - 1] & TERMINAL) != 0;
+            }
+
+            /**
+             * @brief Returns the bits of the given word of the bitmap which
+             * indicate existing 'next' nodes.
+             */
+            uint32_t children(
+                uint32_t word ) const
+            {
+                return (word + 1 == WORDS) ? flags[word] & CHILDREN : flags[word];
+            }
+
+            bool hasChild(
+                uint32_t symbol ) const
+            {
+                return (flags[symbol / 32] & (1U << (symbol % 32))) != 0;
+            }
+
+            /**
+             * @brief Returns the number of 'next' nodes.
+             */
+            uint32_t degree() const
+            {
+                uint32_t result = 0;
+                for (uint32_t i = 0; i < WORDS; ++i)
+                    result += __builtin_popcount(children(i));
+                return result;
+            }
+
+            /**
+             * @brief Returns the number of 'next' nodes for symbols before the
+             * given one, which is the position of its 'next' node in the edge
+             * pool (relative to @c edges).
+             */
+            uint32_t rank(
+                uint32_t symbol ) const
+            {
+                uint32_t word = symbol / 32;
+                uint32_t result = __builtin_popcount(flags[word] & ((1U << (symbol % 32)) - 1));
+                for (uint32_t i = 0; i < word; ++i)
+                    result += __builtin_popcount(flags[i]);
+                return result;
+            }
+
+            /**
+             * @brief Returns the first symbol starting from the given one which
+             * has a 'next' node, or Alphabet::SIZE if there is none.
+             */
+            uint32_t nextSymbol(
+                uint32_t symbol ) const
+            {
+                for (uint32_t i = symbol / 32; i < WORDS; ++i)
+                {
+                    uint32_t bits = children(i);
+                    if (i == symbol / 32) bits &= ~0U << (symbol % 32);
+                    if (bits != 0) return i * 32 + (uint32_t) __builtin_ctz(bits);
+                }
+                return Alphabet::SIZE;
+            }
+        };
+
+        /**
+         * @brief Cell of the double array. The cell of a state is the cell of
+         * its parent state plus the character index.
+         */
+        struct Cell
+        {
+            /**
+             * @brief First cell of the 'next' states (and the terminal flag).
+             */
+            uint32_t base;
+
+            /**
+             * @brief Parent state of the cell (or NONE if the cell is free).
+             */
+            uint32_t check;
+        };
+
+        /**
+         * @brief Hash function for the registry of minimized nodes.
+         */
+        struct NodeHash
+        {
+            const Graph *graph;
+
+            size_t operator()(
+                uint32_t node ) const;
+        };
+
+        /**
+         * @brief Equivalence of nodes for the registry of minimized nodes.
+         */
+        struct NodeEqual
+        {
+            const Graph *graph;
+
+            bool operator()(
+                uint32_t left,
+                uint32_t right ) const;
+        };
+
+        Arena<Node> nodes;
+
+        Arena<uint32_t> edges;
+
+        /**
+         * @brief Index of the first released node. The @c edges field of each
+         * released node stores the index of the next one (or NIL).
+         */
+        uint32_t released;
+
+        /**
+         * @brief Number of released nodes.
+         */
+        size_t releasedCount;
+
+        /**
+         * @brief Minimized nodes, used while building with @c append.
+         */
+        unordered_set<uint32_t, NodeHash, NodeEqual> registry;
+
+        /**
+         * @brief Nodes of the path of the last word given to @c append.
+         */
+        vector<uint32_t> path;
+
+        /**
+         * @brief Last word given to @c append.
+         */
+        string previous;
+
+        /**
+         * @brief Indicates if the graph was built with @c append.
+         */
+        bool minimal;
+
+        /**
+         * @brief Failure link of each node: the node of the longest proper
+         * suffix of its prefix which is also a prefix in the graph. Empty if
+         * the links were not built.
+         */
+        vector<uint32_t> failure;
+
+        /**
+         * @brief Output link of each node: the first terminal node in its chain
+         * of failure links (or NIL).
+         */
+        vector<uint32_t> output;
+
+        /**
+         * @brief Length of the prefix of each node.
+         */
+        vector<uint32_t> depth;
+
+        /**
+         * @brief Filter of the words which may be compound (empty if it was not
+         * built).
+         */
+        Prefilter filter;
+
+        /**
+         * @brief Double-array copy of the graph (empty if it was not built). The
+         * root state is the first cell.
+         */
+        vector<Cell> cells;
+
+        /**
+         * @brief Mapping of the file given to @c load (or NULL).
+         */
+        void *image;
+
+        size_t imageSize;
+
+        /**
+         * @brief Header of the binary file created by @c save.
+         */
+        struct Header
+        {
+            char magic[8];
+
+            /**
+             * @brief Constant used to detect files created in machines with
+             * different byte order.
+             */
+            uint32_t byteOrder;
+
+            uint32_t version;
+
+            uint64_t nodes;
+
+            uint64_t edges;
+
+            uint64_t released;
+
+            /**
+             * @brief Number of symbols of the alphabet.
+             */
+            uint64_t symbols;
+        };
+
+        /**
+         * @brief Position of the first unused block in the edge pool, by block
+         * size. The first entry of each unused block stores the position of the
+         * next one (or NONE).
+         */
+        uint32_t unused[Alphabet::SIZE + 1];
+
+        /**
+         * @brief Returns the index of the 'next' node of the given node for the
+         * given character index, or NIL if there is no such node.
+         */
+        uint32_t next(
+            uint32_t node,
+            uint32_t symbol ) const;
+
+        /**
+         * @brief Creates a 'next' node for given node and character index and
+         * returns its index.
+         */
+        uint32_t insert(
+            uint32_t node,
+            uint32_t symbol );
+
+        /**
+         * @brief Removes the 'next' node of the given node for the given
+         * character index (the 'next' node itself is not released).
+         */
+        void unlink(
+            uint32_t node,
+            uint32_t symbol );
+
+        /**
+         * @brief Makes @c index the 'next' node of the given node for the given
+         * character index, which the node must not have yet.
+         */
+        void link(
+            uint32_t node,
+            uint32_t symbol,
+            uint32_t index );
+
+        /**
+         * @brief Prefixes of a word which have a valid split, as a bitmask in a
+         * register (for words shorter than the number of bits). Only whether a
+         * split exists is known, not the split itself.
+         */
+        template<typename Mask> struct MaskPositions
+        {
+            Mask reached;
+
+            void reset(
+                size_t )
+            {
+                reached = 1;
+            }
+
+            bool has(
+                size_t position ) const
+            {
+                return ((reached >> position) & 1) != 0;
+            }
+
+            void set(
+                size_t end,
+                size_t )
+            {
+                reached |= (Mask) 1 << end;
+            }
+        };
+
+        /**
+         * @brief Prefixes of a word which have a valid split, storing in
+         * @c origin (which must have room for @c length + 1 positions) where the
+         * last sub-word of the first split found for each prefix starts.
+         */
+        struct OriginPositions
+        {
+            static const uint32_t UNKNOWN = 0xFFFFFFFF;
+
+            uint32_t *origin;
+
+            void reset(
+                size_t length )
+            {
+                for (size_t i = 1; i <= length; ++i)
+                    origin[i] = UNKNOWN;
+                origin[0] = 0;
+            }
+
+            bool has(
+                size_t position ) const
+            {
+                return origin[position] != UNKNOWN;
+            }
+
+            void set(
+                size_t end,
+                size_t start )
+            {
+                origin[end] = (uint32_t) start;
+            }
+        };
+
+        /**
+         * @brief Segments the given word as @c isCompoundWord, storing in
+         * @c positions the prefixes which have a valid split.
+         *
+         * The kernels are specialized at compile time for each kind of
+         * @c positions, so checking a short word only uses registers and a
+         * split is only recorded when it is needed.
+         */
+        template<typename Positions> bool segment(
+            const char *word,
+            size_t length,
+            Positions &positions,
+            Counters *counters ) const;
+
+        /**
+         * @brief Segments the given word as @c segment, but following the
+         * failure and output links in a single pass over the word.
+         */
+        template<typename Positions> bool segmentLinked(
+            const char *word,
+            size_t length,
+            Positions &positions,
+            Counters *counters ) const;
+
+        /**
+         * @brief Segments the given word as @c segment, but using the double
+         * array.
+         */
+        template<typename Positions> bool segmentDouble(
+            const char *word,
+            size_t length,
+            Positions &positions,
+            Counters *counters ) const;
+
+        /**
+         * @brief Returns the end of the first sub-word starting at @c position
+         * which ends at or after @c from and is followed by a valid split (as
+         * indicated by @c splittable), or 0 if there is no such sub-word.
+         */
+        size_t nextPart(
+            const char *word,
+            size_t length,
+            size_t position,
+            size_t from,
+            const vector<char> &splittable ) const;
+
+        /**
+         * @brief Returns a new node (reusing released ones).
+         */
+        uint32_t allocate();
+
+        /**
+         * @brief Releases a node and its block in the edge pool.
+         */
+        void release(
+            uint32_t node );
+
+        /**
+         * @brief Replaces the nodes of @c path after the given depth by
+         * equivalent nodes already minimized, or registers them.
+         */
+        void minimize(
+            size_t depth );
+
+        /**
+         * @brief Returns a boolean value indicating if the given nodes and edge
+         * pool (read from a file) are a valid graph: every block of 'next' nodes
+         * is inside the pool, every 'next' node exists and no node can be
+         * reached from itself.
+         */
+        static bool isValid(
+            const Node *nodes,
+            size_t nodeCount,
+            const uint32_t *edges,
+            size_t edgeCount );
+};
+
+
+// NIL is passed by reference to the vector constructor (and in the links
+// code), so it needs a definition
+const uint32_t Graph::NIL;
+
+
+Graph::Graph() : released(NIL), releasedCount(0), minimal(false), image(NULL), imageSize(0)
+{
+    NodeHash hash = { this };
+    NodeEqual equal = { this };
+    registry = unordered_set<uint32_t, NodeHash, NodeEqual>(0, hash, equal);
+
+    // the root is the only node which is not a 'next' node
+    nodes.allocate(1);
+    for (size_t i = 0; i <= Alphabet::SIZE; ++i)
+        unused[i] = NONE;
+}
+
+
+inline uint32_t Graph::next(
+    uint32_t node,
+    uint32_t symbol ) const
+{
+    const Node &current = nodes[node];
+
+    if (!current.hasChild(symbol)) return NIL;
+    return edges[ current.edges + current.rank(symbol) ];
+}
+
+
+uint32_t Graph::insert(
+    uint32_t node,
+    uint32_t symbol )
+{
+    uint32_t index = allocate();
+    link(node, symbol, index);
+    return index;
+}
+
+
+void Graph::link(
+    uint32_t node,
+    uint32_t symbol,
+    uint32_t index )
+{
+    uint32_t count = nodes[node].degree();
+    uint32_t rank = nodes[node].rank(symbol);
+
+    // the list of 'next' nodes must be contiguous, so we need a larger block
+    uint32_t block = unused[count + 1];
+    if (block == NONE)
+        block = (uint32_t) edges.allocate(count + 1);
+    else
+        unused[count + 1] = edges[block];
+
+    Node &current = nodes[node];
+    for (uint32_t i = 0; i < rank; ++i)
+        edges[block + i] = edges[current.edges + i];
+    edges[block + rank] = index;
+    for (uint32_t i = rank; i < count; ++i)
+        edges[block + i + 1] = edges[current.edges + i];
+
+    if (count > 0)
+    {
+        edges[current.edges] = unused[count];
+        unused[count] = current.edges;
+    }
+    current.edges = block;
+    current.flags[symbol / 32] |= 1U << (symbol % 32);
+}
+
+
+void Graph::unlink(
+    uint32_t node,
+    uint32_t symbol )
+{
+    uint32_t count = nodes[node].degree();
+    uint32_t rank = nodes[node].rank(symbol);
+
+    // the list of 'next' nodes must be contiguous, so we need a smaller block
+    uint32_t block = 0;
+    if (count > 1)
+    {
+        block = unused[count - 1];
+        if (block == NONE)
+            block = (uint32_t) edges.allocate(count - 1);
+        else
+            unused[count - 1] = edges[block];
+    }
+
+    Node &current = nodes[node];
+    for (uint32_t i = 0; i < rank; ++i)
+        edges[block + i] = edges[current.edges + i];
+    for (uint32_t i = rank + 1; i < count; ++i)
+        edges[block + i - 1] = edges[current.edges + i];
+
+    edges[current.edges] = unused[count];
+    unused[count] = current.edges;
+    current.edges = block;
+    current.flags[symbol / 32] &= ~(1U << (symbol % 32));
+}
+
+
+void Graph::merge(
+    const Graph &other )
+{
+    // the root of 'other' is not copied, so its node 'i' becomes 'base + i - 1'
+    uint32_t base = (uint32_t) nodes.allocate(other.nodes.size() - 1) - 1;
+    uint32_t offset = (uint32_t) edges.allocate(other.edges.size());
+
+    for (size_t i = 1, t = other.nodes.size(); i < t; ++i)
+    {
+        Node node = other.nodes[i];
+        if (node.degree() != 0) node.edges += offset;
+        nodes[base + i] = node;
+    }
+    // entries of unused blocks are relocated too, but fixed below
+    for (size_t i = 0, t = other.edges.size(); i < t; ++i)
+        edges[offset + i] = base + other.edges[i];
+
+    // appends our lists of released nodes and unused blocks to the ones of 'other'
+    for (uint32_t node = other.released; node != NIL; node = other.nodes[node].edges)
+    {
+        uint32_t following = other.nodes[node].edges;
+        nodes[base + node].edges = (following == NIL) ? released : base + following;
+    }
+    if (other.released != NIL) released = base + other.released;
+    releasedCount += other.releasedCount;
+
+    for (size_t i = 0; i <= Alphabet::SIZE; ++i)
+    {
+        for (uint32_t block = other.unused[i]; block != NONE; block = other.edges[block])
+        {
+            uint32_t following = other.edges[block];
+            edges[offset + block] = (following == NONE) ? unused[i] : offset + following;
+        }
+        if (other.unused[i] != NONE) unused[i] = offset + other.unused[i];
+    }
+
+    const Node &root = other.nodes[0];
+    uint32_t rank = 0;
+    for (uint32_t symbol = root.nextSymbol(0); symbol < Alphabet::SIZE; symbol = root.nextSymbol(symbol + 1))
+        link(0, symbol, base + other.edges[root.edges + rank++]);
+    // the block of the root of 'other' is not used anymore
+    uint32_t count = root.degree();
+    if (count > 0)
+    {
+        edges[offset + root.edges] = unused[count];
+        unused[count] = offset + root.edges;
+    }
+}
+
+
+uint32_t Graph::allocate()
+{
+    if (released == NIL) return (uint32_t) nodes.allocate(1);
+
+    uint32_t index = released;
+    released = nodes[index].edges;
+    --releasedCount;
+
+    memset(&nodes[index], 0, sizeof(Node));
+    return index;
+}
+
+
+void Graph::release(
+    uint32_t node )
+{
+    Node &current = nodes[node];
+    uint32_t count = current.degree();
+
+    if (count > 0)
+    {
+        edges[current.edges] = unused[count];
+        unused[count] = current.edges;
+    }
+
+    memset(current.flags, 0, sizeof(current.flags));
+    current.edges = released;
+    released = node;
+    ++releasedCount;
+}
+
+
+size_t Graph::NodeHash::operator()(
+    uint32_t node ) const
+{
+    const Node &current = graph->nodes[node];
+    uint64_t hash = 0;
+
+    for (uint32_t i = 0; i < WORDS; ++i)
+        hash = (hash ^ current.flags[i]) * 0x100000001B3ULL;
+    for (uint32_t i = 0, t = current.degree(); i < t; ++i)
+        hash = (hash ^ graph->edges[current.edges + i]) * 0x100000001B3ULL;
+    return (size_t) (hash ^ (hash >> 32));
+}
+
+
+bool Graph::NodeEqual::operator()(
+    uint32_t left,
+    uint32_t right ) const
+{
+    const Node &first = graph->nodes[left];
+    const Node &second = graph->nodes[right];
+
+    if (memcmp(first.flags, second.flags, sizeof(first.flags)) != 0) return false;
+    for (uint32_t i = 0, t = first.degree(); i < t; ++i)
+        if (graph->edges[first.edges + i] != graph->edges[second.edges + i]) return false;
+    return true;
+}
+
+
+void Graph::minimize(
+    size_t depth )
+{
+    // from the deepest node up, since a node can only be compared after
+    // its 'next' nodes are minimized
+    for (size_t i = path.size() - 1; i > depth; --i)
+    {
+        uint32_t child = path[i];
+        unordered_set<uint32_t, NodeHash, NodeEqual>::iterator it = registry.find(child);
+
+        if (it == registry.end())
+        {
+            registry.insert(child);
+            continue;
+        }
+
+        // the child is always the last 'next' node of its parent
+        const Node &parent = nodes[ path[i - 1] ];
+        edges[ parent.edges + parent.degree() - 1 ] = *it;
+        release(child);
+    }
+    path.resize(depth + 1);
+}
+
+
+void Graph::append(
+    const char *value,
+    size_t length )
+{
+    // words with invalid characters are not included
+    for (size_t i = 0; i < length; ++i)
+        if (Alphabet::symbol((unsigned char) value[i]) == Alphabet::SIZE) return;
+    if (length == 0) return;
+
+    if (path.empty()) path.push_back(0);
+    minimal = true;
+
+    size_t common = 0;
+    size_t limit = std::min(length, previous.length());
+    while (common < limit && value[common] == previous[common]) ++common;
+
+    minimize(common);
+
+    uint32_t current = path.back();
+    for (size_t i = common; i < length; ++i)
+    {
+        current = insert(current, Alphabet::symbol((unsigned char) value[i]));
+        path.push_back(current);
+    }
+    nodes[current].flags[WORDS - 1] |= TERMINAL;
+
+    previous.assign(value, length);
+}
+
+
+void Graph::finish()
+{
+    if (!path.empty()) minimize(0);
+
+    // the registry is only needed while building
+    unordered_set<uint32_t, NodeHash, NodeEqual>(0, registry.hash_function(),
+        registry.key_eq()).swap(registry);
+    path.clear();
+    previous.clear();
+}
+
+
+void Graph::parse(
+    const string &value )
+{
+    parse(value.c_str(), value.length());
+}
+
+
+void Graph::parse(
+    const char *value,
+    size_t length )
+{
+    // words with invalid characters are not included
+    for (size_t i = 0; i < length; ++i)
+        if (Alphabet::symbol((unsigned char) value[i]) == Alphabet::SIZE) return;
+    if (length == 0) return;
+
+    uint32_t current = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint32_t symbol = Alphabet::symbol((unsigned char) value[i]);
+        uint32_t index = next(current, symbol);
+        if (index == NIL) index = insert(current, symbol);
+        current = index;
+    }
+    nodes[current].flags[WORDS - 1] |= TERMINAL;
+
+    #if (DEBUG_PARSE == 1)
+    std::cout << "Parsed " << string(value, length) << std::endl;
+    #endif
+}
+
+
+bool Graph::contains(
+    const char *value,
+    size_t length ) const
+{
+    uint32_t current = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint32_t symbol = Alphabet::symbol((unsigned char) value[i]);
+        if (symbol == Alphabet::SIZE) return false;
+        current = next(current, symbol);
+        if (current == NIL) return false;
+    }
+    return length > 0 && nodes[current].isTerminal();
+}
+
+
+bool Graph::remove(
+    const char *value,
+    size_t length )
+{
+    if (length == 0) return false;
+
+    vector<uint32_t> trail(1, 0);
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint32_t symbol = Alphabet::symbol((unsigned char) value[i]);
+        if (symbol == Alphabet::SIZE) return false;
+        uint32_t current = next(trail.back(), symbol);
+        if (current == NIL) return false;
+        trail.push_back(current);
+    }
+    if (!nodes[trail.back()].isTerminal()) return false;
+    nodes[trail.back()].flags[WORDS - 1] &= ~TERMINAL;
+
+    // releases the nodes from the end of the word while they are not a prefix
+    // of other words
+    for (size_t i = length; i > 0; --i)
+    {
+        uint32_t node = trail[i];
+        if (nodes[node].isTerminal() || nodes[node].degree() > 0) break;
+        unlink(trail[i - 1], Alphabet::symbol((unsigned char) value[i - 1]));
+        release(node);
+    }
+
+    #if (DEBUG_PARSE == 1)
+    std::cout << "Removed " << string(value, length) << std::endl;
+    #endif
+    return true;
+}
+
+
+bool Graph::isEditable() const
+{
+    return !minimal && image == NULL && failure.empty() && filter.empty() && cells.empty();
+}
+
+
+bool Graph::isCompoundWord(
+    const string &word ) const
+{
+    return isCompoundWord(word.c_str(), word.length());
+}
+
+
+template<typename Positions> bool Graph::segment(
+    const char *value,
+    size_t length,
+    Positions &positions,
+    Counters *counters ) const
+{
+    // the empty word is not a concatenation of dictionary words
+    if (length == 0) return false;
+    if (!filter.empty() && !filter.accepts(value, length))
+    {
+        if (counters != NULL) ++counters->filtered;
+        return false;
+    }
+    if (!failure.empty()) return segmentLinked(value, length, positions, counters);
+    if (!cells.empty()) return segmentDouble(value, length, positions, counters);
+
+    positions.reset(length);
+    uint64_t steps = 0;
+    uint64_t restarts = 0;
+
+    for (size_t i = 0; i < length && !positions.has(length); ++i)
+    {
+        // only positions reachable by a valid split can start a sub-word
+        if (!positions.has(i)) continue;
+        ++restarts;
+
+        #if (DEBUG_PROCESS == 1)
+        std::cout << "From root looking for " << value[i] << std::endl;
+        #endif
+        uint32_t current = 0;
+        for (size_t j = i; j < length; ++j)
+        {
+            uint32_t symbol = Alphabet::symbol((unsigned char) value[j]);
+            if (symbol == Alphabet::SIZE) break;
+
+            current = next(current, symbol);
+            ++steps;
+            if (current == NIL) break;
+
+            // the word itself is not a valid sub-word
+            if (nodes[current].isTerminal() && !positions.has(j + 1) && (i > 0 || j + 1 < length))
+                positions.set(j + 1, i);
+        }
+    }
+
+    if (counters != NULL)
+    {
+        counters->steps += steps;
+        counters->restarts += restarts;
+    }
+
+    return positions.has(length);
+}
+
+
+template<typename Positions> bool Graph::segmentLinked(
+    const char *value,
+    size_t length,
+    Positions &positions,
+    Counters *counters ) const
+{
+    positions.reset(length);
+    uint64_t steps = 0;
+
+    uint32_t current = 0;
+    for (size_t j = 0; j < length; ++j)
+    {
+        // no sub-word contains the character, so no split goes beyond it
+        uint32_t symbol = Alphabet::symbol((unsigned char) value[j]);
+        if (symbol == Alphabet::SIZE) break;
+
+        // follows the failure links until some suffix can be extended
+        uint32_t state;
+        while ((state = next(current, symbol)) == NIL && current != 0)
+        {
+            current = failure[current];
+            ++steps;
+        }
+        current = state;
+        ++steps;
+
+        // the sub-words ending here are the terminal nodes in the chain of
+        // output links, from the longest to the shortest; the first one after
+        // a valid split gives the same split as @c segment
+        size_t end = j + 1;
+        uint32_t match = nodes[current].isTerminal() ? current : output[current];
+        for (; match != NIL; match = output[match])
+        {
+            size_t start = end - depth[match];
+            ++steps;
+            // the word itself is not a valid sub-word
+            if (positions.has(start) && (start > 0 || end < length))
+            {
+                positions.set(end, start);
+                break;
+            }
+        }
+    }
+
+    if (counters != NULL) counters->steps += steps;
+
+    return positions.has(length);
+}
+
+
+template<typename Positions> bool Graph::segmentDouble(
+    const char *value,
+    size_t length,
+    Positions &positions,
+    Counters *counters ) const
+{
+    positions.reset(length);
+    uint64_t steps = 0;
+    uint64_t restarts = 0;
+    const Cell *table = &cells[0];
+
+    for (size_t i = 0; i < length && !positions.has(length); ++i)
+    {
+        if (!positions.has(i)) continue;
+        ++restarts;
+
+        uint32_t current = 0;
+        for (size_t j = i; j < length; ++j)
+        {
+            uint32_t symbol = Alphabet::symbol((unsigned char) value[j]);
+            if (symbol == Alphabet::SIZE) break;
+
+            // every state has room for all symbols after its base, so the
+            // target cell always exists
+            uint32_t target = (table[current].base & ~TERMINAL) + symbol;
+            ++steps;
+            if (table[target].check != current) break;
+            current = target;
+
+            // the word itself is not a valid sub-word
+            if ((table[current].base & TERMINAL) != 0 && !positions.has(j + 1) && (i > 0 || j + 1 < length))
+                positions.set(j + 1, i);
+        }
+    }
+
+    if (counters != NULL)
+    {
+        counters->steps += steps;
+        counters->restarts += restarts;
+    }
+
+    return positions.has(length);
+}
+
+
+bool Graph::buildDoubleArray()
+{
+    static const uint32_t UNKNOWN = 0xFFFFFFFF;
+
+    // a free cell which failed this many times as the first cell of a base is
+    // not tried again (it can still be used by other bases)
+    static const uint8_t ATTEMPTS = 16;
+
+    /**
+     * Free cells of the double array in increasing order, linked in both
+     * directions.
+     */
+    struct FreeList
+    {
+        vector<Cell> &table;
+
+        vector<uint32_t> following;
+
+        vector<uint32_t> preceding;
+
+        /**
+         * @brief Number of times each cell failed as first cell of a base
+         * (@c ATTEMPTS if it is not in the list anymore).
+         */
+        vector<uint8_t> failures;
+
+        uint32_t first;
+
+        uint32_t last;
+
+        void append()
+        {
+            uint32_t index = (uint32_t) table.size();
+            Cell cell = { 0, NONE };
+            table.push_back(cell);
+            following.push_back((uint32_t) NONE);
+            preceding.push_back(last);
+            failures.push_back(0);
+            if (last == NONE)
+                first = index;
+            else
+                following[last] = index;
+            last = index;
+        }
+
+        void fail(
+            uint32_t index )
+        {
+            if (++failures[index] == ATTEMPTS)
+            {
+                --failures[index];
+                remove(index);
+            }
+        }
+
+        void remove(
+            uint32_t index )
+        {
+            if (failures[index] == ATTEMPTS) return;
+            failures[index] = ATTEMPTS;
+            if (preceding[index] == NONE)
+                first = following[index];
+            else
+                following[preceding[index]] = following[index];
+            if (following[index] == NONE)
+                last = preceding[index];
+            else
+                preceding[following[index]] = preceding[index];
+        }
+    };
+
+    vector<Cell> table;
+    FreeList available = { table, vector<uint32_t>(), vector<uint32_t>(), vector<uint8_t>(), NONE, NONE };
+    for (uint32_t i = 0; i <= Alphabet::SIZE; ++i)
+        available.append();
+    // the root takes the first cell
+    available.remove(0);
+    table[0].check = 0;
+
+    // cell of each node, to detect nodes reached twice
+    vector<uint32_t> state(nodes.size(), UNKNOWN);
+    state[0] = 0;
+
+    // breadth-first, so the children of a node are placed near each other
+    vector<uint32_t> queue(1, 0);
+    vector<uint32_t> symbols;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        uint32_t node = queue[i];
+        const Node &current = nodes[node];
+        symbols.clear();
+        for (uint32_t symbol = current.nextSymbol(0); symbol < Alphabet::SIZE; symbol = current.nextSymbol(symbol + 1))
+            symbols.push_back(symbol);
+
+        // finds the first base whose cells for the symbols are available; there is
+        // always room for every symbol after the last available cell, so the search
+        // ends
+        uint32_t base = 0;
+        for (uint32_t cell = available.first; !symbols.empty(); cell = available.following[cell])
+        {
+            if (cell <= symbols[0]) continue;
+            base = cell - symbols[0];
+            while (table.size() <= (size_t) base + Alphabet::SIZE) available.append();
+
+            bool fits = true;
+            for (size_t j = 1; j < symbols.size() && fits; ++j)
+                fits = table[base + symbols[j]].check == NONE;
+            if (fits) break;
+            available.fail(cell);
+        }
+
+        uint32_t parent = state[node];
+        table[parent].base = base | (current.isTerminal() ? TERMINAL : 0);
+        for (size_t j = 0; j < symbols.size(); ++j)
+        {
+            uint32_t child = next(node, symbols[j]);
+            // a node reached twice means the graph is not a tree
+            if (state[child] != UNKNOWN) return false;
+
+            uint32_t index = base + symbols[j];
+            available.remove(index);
+            table[index].check = parent;
+            state[child] = index;
+            queue.push_back(child);
+        }
+    }
+
+    cells.swap(table);
+    return true;
+}
+
+
+bool Graph::buildLinks()
+{
+    static const uint32_t UNKNOWN = 0xFFFFFFFF;
+
+    size_t total = nodes.size();
+    vector<uint32_t>(total, 0).swap(failure);
+    vector<uint32_t>(total, NIL).swap(output);
+    vector<uint32_t>(total, UNKNOWN).swap(depth);
+
+    // breadth-first, so the failure link of a node is known before its children
+    vector<uint32_t> queue;
+    queue.push_back(0);
+    depth[0] = 0;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        uint32_t parent = queue[i];
+        const Node &node = nodes[parent];
+        for (uint32_t symbol = node.nextSymbol(0); symbol < Alphabet::SIZE; symbol = node.nextSymbol(symbol + 1))
+        {
+            uint32_t child = next(parent, symbol);
+            // a node reached twice means the graph is not a tree
+            if (depth[child] != UNKNOWN)
+            {
+                vector<uint32_t>().swap(failure);
+                vector<uint32_t>().swap(output);
+                vector<uint32_t>().swap(depth);
+                return false;
+            }
+            depth[child] = depth[parent] + 1;
+            queue.push_back(child);
+
+            if (parent == 0) continue;
+            uint32_t suffix = failure[parent];
+            uint32_t target;
+            while ((target = next(suffix, symbol)) == NIL && suffix != 0)
+                suffix = failure[suffix];
+            failure[child] = target;
+            output[child] = nodes[target].isTerminal() ? target : output[target];
+        }
+    }
+
+    return true;
+}
+
+
+bool Graph::isCompoundWord(
+    const char *value,
+    size_t length,
+    Counters *counters ) const
+{
+    // the kernel is chosen once for the word: most words fit in a register,
+    // longer ones in a stack buffer
+    if (length < 64)
+    {
+        MaskPositions<uint64_t> positions;
+        return segment(value, length, positions, counters);
+    }
+    if (length < 256)
+    {
+        uint32_t buffer[256];
+        OriginPositions positions = { buffer };
+        return segment(value, length, positions, counters);
+    }
+
+    if (length >= 0xFFFFFFFF) return false;
+    vector<uint32_t> heap(length + 1);
+    OriginPositions positions = { &heap[0] };
+    return segment(value, length, positions, counters);
+}
+
+
+void Graph::isCompoundWords(
+    const char * const *words,
+    const size_t *lengths,
+    size_t count,
+    bool *results,
+    Counters *counters ) const
+{
+    static const uint32_t UNKNOWN = 0xFFFFFFFF;
+    static const size_t LANES = 16;
+    static const size_t CAPACITY = 128;
+
+    if (!failure.empty() || !cells.empty())
+    {
+        for (size_t i = 0; i < count; ++i)
+            results[i] = isCompoundWord(words[i], lengths[i], counters);
+        return;
+    }
+
+    /**
+     * Word being segmented (as in @c segment) by the batch.
+     */
+    struct Lane
+    {
+        /**
+         * @brief Position of the word in the batch.
+         */
+        size_t index;
+
+        const char *word;
+
+        size_t length;
+
+        /**
+         * @brief Position where the current sub-word starts.
+         */
+        size_t start;
+
+        /**
+         * @brief Position after the last character of the current sub-word.
+         */
+        size_t end;
+
+        /**
+         * @brief Node reached by the current sub-word (prefetched when the
+         * previous character was consumed).
+         */
+        uint32_t node;
+
+        uint32_t origin[CAPACITY];
+    };
+
+    Lane lanes[LANES];
+    Lane *order[LANES];
+    for (size_t i = 0; i < LANES; ++i)
+        order[i] = &lanes[i];
+    size_t active = 0;
+    size_t taken = 0;
+    uint64_t steps = 0;
+    uint64_t restarts = 0;
+    uint64_t filtered = 0;
+
+    // the first 'active' lanes of 'order' have a word, the others are idle
+    while (true)
+    {
+        // takes words for the idle lanes; words which do not fit in a lane
+        // are checked right away
+        while (active < LANES && taken < count)
+        {
+            size_t index = taken++;
+            const char *word = words[index];
+            size_t length = lengths[index];
+            if (!filter.empty() && !filter.accepts(word, length))
+            {
+                ++filtered;
+                results[index] = false;
+                continue;
+            }
+            if (length == 0 || length >= CAPACITY)
+            {
+                results[index] = isCompoundWord(word, length, counters);
+                continue;
+            }
+
+            Lane &lane = *order[active++];
+            lane.index = index;
+            lane.word = word;
+            lane.length = length;
+            for (size_t i = 1; i <= length; ++i)
+                lane.origin[i] = UNKNOWN;
+            lane.origin[0] = 0;
+            lane.start = lane.end = 0;
+            lane.node = 0;
+            ++restarts;
+        }
+        if (active == 0) break;
+
+        for (size_t i = 0; i < active; )
+        {
+            Lane &lane = *order[i];
+            size_t length = lane.length;
+            size_t end = lane.end;
+            uint32_t *origin = lane.origin;
+
+            // the node was prefetched in the previous step
+            const Node &current = nodes[lane.node];
+            if (end > lane.start && current.isTerminal() && origin[end] == UNKNOWN &&
+                (lane.start > 0 || end < length))
+                origin[end] = (uint32_t) lane.start;
+
+            if (end < length)
+            {
+                uint32_t symbol = Alphabet::symbol((unsigned char) lane.word[end]);
+                if (symbol != Alphabet::SIZE)
+                {
+                    ++steps;
+                    if (current.hasChild(symbol))
+                    {
+                        uint32_t node = edges[current.edges + current.rank(symbol)];
+                        __builtin_prefetch(&nodes[node]);
+                        lane.node = node;
+                        lane.end = end + 1;
+                        ++i;
+                        continue;
+                    }
+                }
+            }
+
+            // the sub-word ended; starts the next one at the next position
+            // reachable by a valid split
+            size_t start = lane.start + 1;
+            while (start < length && origin[start] == UNKNOWN) ++start;
+            if (start < length && origin[length] == UNKNOWN)
+            {
+                // the root is always in the cache, so the lane goes on
+                lane.start = lane.end = start;
+                lane.node = 0;
+                ++restarts;
+                continue;
+            }
+
+            // the word is done; the last active lane takes its place
+            results[lane.index] = lane.origin[length] != UNKNOWN;
+            std::swap(order[i], order[--active]);
+        }
+    }
+
+    if (counters != NULL)
+    {
+        counters->steps += steps;
+        counters->restarts += restarts;
+        counters->filtered += filtered;
+    }
+}
+
+
+bool Graph::split(
+    const char *value,
+    size_t length,
+    vector<Span> &parts,
+    Counters *counters ) const
+{
+    uint32_t buffer[256];
+    vector<uint32_t> heap;
+
+    parts.clear();
+    if (length >= 0xFFFFFFFF) return false;
+    uint32_t *origin = buffer;
+    if (length >= 256)
+    {
+        heap.resize(length + 1);
+        origin = &heap[0];
+    }
+
+    OriginPositions positions = { origin };
+    if (!segment(value, length, positions, counters)) return false;
+
+    // the split is found from the end of the word
+    for (size_t end = length; end > 0; end = origin[end])
+    {
+        Span part = { origin[end], (uint32_t) end - origin[end] };
+        parts.push_back(part);
+    }
+    std::reverse(parts.begin(), parts.end());
+
+    return true;
+}
+
+
+size_t Graph::nextPart(
+    const char *value,
+    size_t length,
+    size_t position,
+    size_t from,
+    const vector<char> &splittable ) const
+{
+    uint32_t current = 0;
+
+    for (size_t j = position; j < length; ++j)
+    {
+        uint32_t symbol = Alphabet::symbol((unsigned char) value[j]);
+        if (symbol == Alphabet::SIZE) break;
+
+        current = next(current, symbol);
+        if (current == NIL) break;
+
+        size_t end = j + 1;
+        if (end >= from && nodes[current].isTerminal() && splittable[end] &&
+            (position > 0 || end < length)) return end;
+    }
+
+    return 0;
+}
+
+
+void Graph::findWords(
+    const char *text,
+    size_t length,
+    vector<Span> &matches ) const
+{
+    matches.clear();
+    if (length >= 0xFFFFFFFF) return;
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint32_t current = 0;
+        for (size_t j = i; j < length; ++j)
+        {
+            uint32_t symbol = Alphabet::symbol((unsigned char) text[j]);
+            if (symbol == Alphabet::SIZE) break;
+            current = next(current, symbol);
+            if (current == NIL) break;
+
+            if (nodes[current].isTerminal())
+            {
+                Span match = { (uint32_t) i, (uint32_t) (j + 1 - i) };
+                matches.push_back(match);
+            }
+        }
+    }
+}
+
+
+size_t Graph::splitAll(
+    const char *value,
+    size_t length,
+    vector< vector<Span> > &splits,
+    size_t limit ) const
+{
+    splits.clear();
+    if (length == 0 || length >= 0xFFFFFFFF || limit == 0) return 0;
+
+    // 'splittable[i]' indicates if the characters from 'i' to the end can be
+    // split in sub-words
+    vector<char> splittable(length + 1, 0);
+    splittable[length] = 1;
+    for (size_t i = length; i-- > 0; )
+        splittable[i] = nextPart(value, length, i, i + 1, splittable) != 0;
+    if (!splittable[0]) return 0;
+
+    // depth-first search of the splits, trying the shortest part first
+    vector<Span> parts;
+    size_t position = 0;
+    size_t from = 1;
+    while (true)
+    {
+        size_t end = nextPart(value, length, position, from, splittable);
+        if (end == 0)
+        {
+            if (parts.empty()) break;
+
+            // tries a longer sub-word in the place of the last one
+            Span last = parts.back();
+            parts.pop_back();
+            position = last.offset;
+            from = last.offset + last.length + 1;
+            continue;
+        }
+
+        Span part = { (uint32_t) position, (uint32_t) (end - position) };
+        parts.push_back(part);
+        if (end < length)
+        {
+            position = end;
+            from = end + 1;
+            continue;
+        }
+
+        splits.push_back(parts);
+        if (splits.size() >= limit) break;
+        parts.pop_back();
+        from = end + 1;
+    }
+
+    return splits.size();
+}
+
+
+Graph::~Graph()
+{
+    if (image != NULL) munmap(image, imageSize);
+}
+
+
+bool Graph::save(
+    const string &fileName ) const
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "QUIZIDX", 8);
+    header.byteOrder = 0x01020304;
+    header.version = 2;
+    header.nodes = nodes.size();
+    header.edges = edges.size();
+    header.released = releasedCount;
+    header.symbols = Alphabet::SIZE;
+
+    FILE *output = fopen(fileName.c_str(), "wb");
+    if (output == NULL) return false;
+
+    bool result = fwrite(&header, sizeof(header), 1, output) == 1 &&
+        fwrite(nodes.begin(), sizeof(Node), nodes.size(), output) == nodes.size() &&
+        fwrite(edges.begin(), sizeof(uint32_t), edges.size(), output) == edges.size();
+
+    return fclose(output) == 0 && result;
+}
+
+
+bool Graph::load(
+    const string &fileName )
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    void *region = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(Header))
+        region = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) return false;
+
+    const Header &header = *(const Header*) region;
+    size_t size = (size_t) info.st_size;
+    char *data = (char*) region + sizeof(Header);
+    // the sizes are checked one at a time, so they can not overflow (and the
+    // indices must fit in 32 bits)
+    size_t available = size - sizeof(Header);
+    bool valid = memcmp(header.magic, "QUIZIDX", 8) == 0 && header.byteOrder == 0x01020304 &&
+        header.version == 2 && header.symbols == Alphabet::SIZE && header.nodes > 0 &&
+        header.nodes <= 0xFFFFFFFF && header.edges <= 0xFFFFFFFF &&
+        header.released < header.nodes && header.nodes <= available / sizeof(Node);
+    if (valid)
+    {
+        available -= (size_t) header.nodes * sizeof(Node);
+        valid = available % sizeof(uint32_t) == 0 && header.edges == available / sizeof(uint32_t) &&
+            isValid((const Node*) data, (size_t) header.nodes,
+                (const uint32_t*) (data + header.nodes * sizeof(Node)), (size_t) header.edges);
+    }
+    if (!valid)
+    {
+        munmap(region, size);
+        return false;
+    }
+
+    if (image != NULL) munmap(image, imageSize);
+    image = region;
+    imageSize = size;
+
+    nodes.wrap((Node*) data, (size_t) header.nodes);
+    edges.wrap((uint32_t*) (data + header.nodes * sizeof(Node)), (size_t) header.edges);
+    releasedCount = (size_t) header.released;
+    vector<uint32_t>().swap(failure);
+    vector<uint32_t>().swap(output);
+    vector<uint32_t>().swap(depth);
+    filter = Prefilter();
+    vector<Cell>().swap(cells);
+    released = NIL;
+    for (size_t i = 0; i <= Alphabet::SIZE; ++i)
+        unused[i] = NONE;
+
+    return true;
+}
+
+
+bool Graph::isValid(
+    const Node *nodes,
+    size_t nodeCount,
+    const uint32_t *edges,
+    size_t edgeCount )
+{
+    // number of 'next' links to each node
+    vector<uint32_t> incoming(nodeCount, 0);
+    for (size_t i = 0; i < nodeCount; ++i)
+    {
+        const Node &current = nodes[i];
+        size_t count = current.degree();
+        if (count == 0) continue;
+        if ((size_t) current.edges + count > edgeCount) return false;
+        for (size_t j = 0; j < count; ++j)
+        {
+            uint32_t child = edges[current.edges + j];
+            if (child >= nodeCount) return false;
+            ++incoming[child];
+        }
+    }
+
+    // removes the nodes without incoming links until every node is removed,
+    // which fails if there is a cycle
+    vector<uint32_t> ready;
+    for (size_t i = 0; i < nodeCount; ++i)
+        if (incoming[i] == 0) ready.push_back((uint32_t) i);
+    size_t removed = 0;
+    while (!ready.empty())
+    {
+        const Node &current = nodes[ready.back()];
+        ready.pop_back();
+        ++removed;
+        size_t count = current.degree();
+        for (size_t j = 0; j < count; ++j)
+        {
+            uint32_t child = edges[current.edges + j];
+            if (--incoming[child] == 0) ready.push_back(child);
+        }
+    }
+    return removed == nodeCount;
+}
+
+
+template<typename Visitor> void Graph::enumerate(
+    const char *prefix,
+    size_t length,
+    Visitor &visitor ) const
+{
+    uint32_t current = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint32_t symbol = Alphabet::symbol((unsigned char) prefix[i]);
+        if (symbol == Alphabet::SIZE) return;
+        current = next(current, symbol);
+        if (current == NIL) return;
+    }
+
+    string word(prefix, length);
+    if (length > 0 && nodes[current].isTerminal()) visitor(word);
+
+    // each entry is a node and the first symbol not visited yet
+    vector< std::pair<uint32_t, uint32_t> > stack;
+    stack.push_back( std::make_pair(current, nodes[current].nextSymbol(0)) );
+    while (!stack.empty())
+    {
+        std::pair<uint32_t, uint32_t> &top = stack.back();
+        if (top.second == Alphabet::SIZE)
+        {
+            stack.pop_back();
+            if (!stack.empty()) word.resize(word.length() - 1);
+            continue;
+        }
+
+        uint32_t symbol = top.second;
+        top.second = nodes[top.first].nextSymbol(symbol + 1);
+
+        uint32_t child = next(top.first, symbol);
+        word += Alphabet::character(symbol);
+        if (nodes[child].isTerminal()) visitor(word);
+        stack.push_back( std::make_pair(child, nodes[child].nextSymbol(0)) );
+    }
+}
+
+
+template<typename Visitor> void Graph::enumerateContaining(
+    const char *pattern,
+    size_t length,
+    Visitor &visitor ) const
+{
+    if (length == 0) return;
+
+    // 'border[i]' is the length of the longest proper border (prefix which is
+    // also a suffix) of the first 'i' characters of the pattern
+    vector<size_t> border(length + 1, 0);
+    for (size_t i = 1, k = 0; i < length; ++i)
+    {
+        while (k > 0 && pattern[i] != pattern[k]) k = border[k];
+        if (pattern[i] == pattern[k]) ++k;
+        border[i + 1] = k;
+    }
+
+    struct Entry
+    {
+        uint32_t node;
+
+        /**
+         * @brief First symbol of the 'next' nodes not visited yet.
+         */
+        uint32_t pending;
+
+        /**
+         * @brief Number of characters of the pattern matched by the end of the
+         * prefix (the length of the pattern once it was found).
+         */
+        size_t matched;
+    };
+
+    vector<Entry> stack;
+    string word;
+    Entry root = { 0, nodes[0].nextSymbol(0), 0 };
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+        Entry &top = stack.back();
+        if (top.pending == Alphabet::SIZE)
+        {
+            stack.pop_back();
+            if (!stack.empty()) word.resize(word.length() - 1);
+            continue;
+        }
+
+        uint32_t symbol = top.pending;
+        top.pending = nodes[top.node].nextSymbol(symbol + 1);
+        uint32_t child = next(top.node, symbol);
+        char character = Alphabet::character(symbol);
+
+        size_t matched = top.matched;
+        if (matched < length)
+        {
+            while (matched > 0 && character != pattern[matched]) matched = border[matched];
+            if (character == pattern[matched]) ++matched;
+        }
+
+        word += character;
+        if (matched == length && nodes[child].isTerminal()) visitor(word);
+
+        Entry entry = { child, nodes[child].nextSymbol(0), matched };
+        stack.push_back(entry);
+    }
+}
+
+
+/**
+ * Appends each visited word to a text, one per line.
+ */
+struct TextVisitor
+{
+    string &text;
+
+    void operator()(
+        const string &word )
+    {
+        text.append(word).append(1, '\n');
+    }
+};
+
+
+void Graph::enumerate(
+    string &text ) const
+{
+    TextVisitor visitor = { text };
+    enumerate("", 0, visitor);
+}
+
+
+/**
+ * Keeps the first longest compound word among the visited words.
+ */
+struct LongestVisitor
+{
+    const Graph &graph;
+
+    string &result;
+
+    bool found;
+
+    void operator()(
+        const string &word )
+    {
+        if ((!found || word.length() > result.length()) &&
+            graph.isCompoundWord(word.c_str(), word.length()))
+        {
+            result = word;
+            found = true;
+        }
+    }
+};
+
+
+bool Graph::longestCompoundWord(
+    const char *prefix,
+    size_t length,
+    string &result ) const
+{
+    LongestVisitor visitor = { *this, result, false };
+    enumerate(prefix, length, visitor);
+    return visitor.found;
+}
+
+
+/**
+ * Includes each visited word in a prefilter (or only counts them if there is no
+ * prefilter).
+ */
+struct FilterVisitor
+{
+    Prefilter *filter;
+
+    size_t count;
+
+    void operator()(
+        const string &word )
+    {
+        if (filter != NULL)
+            filter->add(word.c_str(), word.length());
+        else
+            ++count;
+    }
+};
+
+
+void Graph::buildFilter()
+{
+    // the filter is sized by the number of words, so they are enumerated twice
+    FilterVisitor counter = { NULL, 0 };
+    enumerate("", 0, counter);
+    filter.reset(counter.count);
+
+    FilterVisitor visitor = { &filter, 0 };
+    enumerate("", 0, visitor);
+}
+
+
+template<typename Visitor> void Graph::scan(
+    uint32_t first,
+    uint32_t last,
+    Visitor &visitor,
+    Counters *counters ) const
+{
+    struct Entry
+    {
+        uint32_t node;
+
+        /**
+         * @brief First symbol of the 'next' nodes not visited yet.
+         */
+        uint32_t pending;
+
+        /**
+         * @brief Last symbol to visit.
+         */
+        uint32_t last;
+
+        /**
+         * @brief Position in @c cursors of the nodes reached by the sub-words
+         * which are not finished at this prefix.
+         */
+        size_t cursors;
+
+        size_t count;
+    };
+
+    vector<Entry> stack;
+    vector<uint32_t> cursors;
+    string word;
+    uint64_t steps = 0;
+    uint64_t restarts = 0;
+
+    Entry root = { 0, nodes[0].nextSymbol(first), last, 0, 0 };
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+        Entry &top = stack.back();
+        if (top.pending > top.last)
+        {
+            cursors.resize(top.cursors);
+            stack.pop_back();
+            if (!stack.empty()) word.resize(word.length() - 1);
+            continue;
+        }
+
+        uint32_t symbol = top.pending;
+        top.pending = nodes[top.node].nextSymbol(symbol + 1);
+        uint32_t child = next(top.node, symbol);
+        size_t start = top.cursors;
+        size_t end = top.cursors + top.count;
+        ++steps;
+
+        // advances the sub-words of the prefix; if some of them is finished,
+        // the new prefix can be split in two or more sub-words
+        size_t begin = cursors.size();
+        bool compound = false;
+        for (size_t i = start; i < end; ++i)
+        {
+            uint32_t state = next(cursors[i], symbol);
+            ++steps;
+            if (state == NIL) continue;
+            if (nodes[state].isTerminal()) compound = true;
+            if (std::find(cursors.begin() + (ptrdiff_t) begin, cursors.end(), state) == cursors.end())
+                cursors.push_back(state);
+        }
+
+        word += Alphabet::character(symbol);
+        bool terminal = nodes[child].isTerminal();
+        if (terminal) visitor(word, compound);
+
+        // a new sub-word can start after any valid split of the prefix
+        if (terminal || compound)
+        {
+            cursors.push_back(0);
+            ++restarts;
+        }
+
+        Entry entry = { child, nodes[child].nextSymbol(0), Alphabet::SIZE - 1, begin,
+            cursors.size() - begin };
+        stack.push_back(entry);
+    }
+
+    if (counters != NULL)
+    {
+        counters->steps += steps;
+        counters->restarts += restarts;
+    }
+}
+
+
+size_t Graph::size() const
+{
+    return nodes.size() - releasedCount;
+}
+
+
+size_t Graph::memory() const
+{
+    return nodes.memory() + edges.memory() + filter.memory() + cells.size() * sizeof(Cell) +
+        (failure.size() + output.size() + depth.size()) * sizeof(uint32_t);
+}
+
+
+/**
+ * Reference to a word stored in the buffer of a word list.
+ */
+struct Word
+{
+    size_t offset;
+
+    size_t length;
+};
+
+
+/**
+ * This class holds the words of the input file.
+ *
+ * The whole file is mapped in memory (or read into a single buffer if it can
+ * not be mapped) and each word is a reference to its line in the buffer, so
+ * loading does not allocate memory per word.
+ */
+class WordList
+{
+    public:
+        WordList();
+
+        ~WordList();
+
+        /**
+         * @brief Maps (or reads) the given file in memory. The words are only
+         * available after calling @c split.
+         */
+        bool load(
+            const string &fileName );
+
+        /**
+         * @brief Uses a copy of the given text as the content of the file.
+         */
+        void assign(
+            const string &text );
+
+        /**
+         * @brief Takes every non-empty line of the file as a word. Lines are
+         * normalized in place by the alphabet (for letters, uppercase ones are
+         * converted to lowercase) and lines with characters which are not in
+         * the alphabet are discarded.
+         */
+        void split();
+
+        /**
+         * @brief Takes every non-empty line from @c first to @c last - 1 of the
+         * buffer as a word, as @c split, appending them to @c words. Returns
+         * the number of lines discarded because of invalid characters.
+         */
+        static size_t splitLines(
+            char *buffer,
+            size_t first,
+            size_t last,
+            vector<Word> &words );
+
+        /**
+         * @brief Uses the given buffer (allocated with @c malloc, with @c size
+         * bytes of content) and the words already found in it, as if the file
+         * was loaded and split. The content of @c words is taken.
+         */
+        void adopt(
+            char *buffer,
+            size_t size,
+            vector<Word> &words,
+            size_t discarded );
+
+        /**
+         * @brief Returns the number of lines discarded by @c split because of
+         * invalid characters.
+         */
+        size_t discardedCount() const
+        {
+            return discarded;
+        }
+
+        /**
+         * @brief Sorts the words in lexicographic order.
+         *
+         * If the words are already sorted (as usual for dictionaries) nothing
+         * is done. Otherwise the words are sorted with a MSD radix sort.
+         */
+        void sort();
+
+        /**
+         * @brief Returns a boolean value indicating if the words are sorted in
+         * lexicographic order.
+         */
+        bool isSorted() const;
+
+        /**
+         * @brief Replaces the words with a front-coded copy and releases the
+         * file content and the word positions.
+         *
+         * Words are stored in blocks of @c BLOCK words: the first word of each
+         * block is stored in full and each other word only stores the length
+         * of the prefix shared with the previous word and the rest of it. For
+         * sorted words this is usually much smaller than the file. From then
+         * on @c data is not available (use @c fetch), and no other change can
+         * be done to the list.
+         */
+        void compress();
+
+        bool isCompressed() const
+        {
+            return compressed;
+        }
+
+        /**
+         * @brief Gets the words from @c first to @c first + @c count - 1 (or
+         * to the end of the list), storing their content and length in @c data
+         * and @c lengths. Returns the number of words got.
+         *
+         * If the list is compressed, the words are decoded into @c scratch
+         * (sequentially, from the start of the block of @c first), so the
+         * pointers are only valid until @c scratch changes. Otherwise they
+         * point to the file content.
+         */
+        size_t fetch(
+            size_t first,
+            size_t count,
+            const char **data,
+            size_t *lengths,
+            string &scratch ) const;
+
+        /**
+         * @brief Returns the number of bytes used by the words.
+         */
+        size_t memory() const;
+
+        size_t size() const
+        {
+            return compressed ? total : words.size();
+        }
+
+        /**
+         * @brief Returns the content of a word (not available if the list is
+         * compressed).
+         */
+        const char *data(
+            size_t index ) const
+        {
+            return buffer + words[index].offset;
+        }
+
+        size_t length(
+            size_t index ) const
+        {
+            if (!compressed) return words[index].length;
+            return word(index).length();
+        }
+
+        string word(
+            size_t index ) const;
+
+    private:
+        /**
+         * @brief Number of words in each block of the compressed list.
+         */
+        static const size_t BLOCK = 16;
+
+        char *buffer;
+
+        size_t capacity;
+
+        /**
+         * @brief Indicates if the buffer is a mapping of the input file.
+         */
+        bool mapped;
+
+        vector<Word> words;
+
+        size_t discarded;
+
+        bool compressed;
+
+        /**
+         * @brief Front-coded words (see @c compress). The numbers are stored
+         * with 7 bits per byte, the highest bit indicating if more bytes follow.
+         */
+        string coded;
+
+        /**
+         * @brief Position in @c coded of each block of words.
+         */
+        vector<size_t> blocks;
+
+        /**
+         * @brief Number of words of the compressed list.
+         */
+        size_t total;
+
+        static void putNumber(
+            string &output,
+            size_t value );
+
+        static size_t getNumber(
+            const char *&input );
+
+        WordList(
+            const WordList & );
+
+        WordList &operator=(
+            const WordList & );
+
+        /**
+         * @brief Reads the whole file into a heap buffer.
+         */
+        bool read(
+            int fd );
+
+        /**
+         * @brief Sorts the words using a MSD radix sort with one bucket for each
+         * character from 'a' to 'z' (plus buckets for the end of the word and
+         * for characters before and after that range).
+         */
+        void radixSort();
+};
+
+
+WordList::WordList() : buffer(NULL), capacity(0), mapped(false), discarded(0), compressed(false),
+    total(0)
+{
+}
+
+
+WordList::~WordList()
+{
+    if (mapped)
+        munmap(buffer, capacity);
+    else
+        free(buffer);
+}
+
+
+bool WordList::load(
+    const string &fileName )
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    // private mapping, so normalizing the words never changes the file
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void *region = mmap(NULL, (size_t) info.st_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (region != MAP_FAILED)
+        {
+            buffer = (char*) region;
+            capacity = (size_t) info.st_size;
+            mapped = true;
+            madvise(buffer, capacity, MADV_SEQUENTIAL);
+        }
+    }
+
+    bool result = mapped || read(fd);
+    close(fd);
+
+    return result;
+}
+
+
+void WordList::assign(
+    const string &text )
+{
+    if (mapped)
+        munmap(buffer, capacity);
+    else
+        free(buffer);
+
+    mapped = false;
+    capacity = text.length();
+    buffer = (char*) malloc(std::max(capacity, (size_t) 1));
+    memcpy(buffer, text.data(), capacity);
+    words.clear();
+}
+
+
+bool WordList::read(
+    int fd )
+{
+    size_t used = 0;
+
+    while (true)
+    {
+        if (used == capacity)
+        {
+            size_t size = std::max(capacity * 2, (size_t) 1 << 20);
+            char *current = (char*) realloc(buffer, size);
+            if (current == NULL) return false;
+            buffer = current;
+            capacity = size;
+        }
+
+        ssize_t count = ::read(fd, buffer + used, capacity - used);
+        if (count < 0) return false;
+        if (count == 0) break;
+        used += (size_t) count;
+    }
+
+    // from now on 'capacity' is the amount of valid data
+    capacity = used;
+    return true;
+}
+
+
+void WordList::split()
+{
+    discarded += splitLines(buffer, 0, capacity, words);
+}
+
+
+size_t WordList::splitLines(
+    char *buffer,
+    size_t first,
+    size_t last,
+    vector<Word> &words )
+{
+    size_t start = first;
+    size_t discarded = 0;
+
+    while (start < last)
+    {
+        size_t invalid;
+        size_t end = start + Alphabet::normalize(buffer + start, last - start, invalid);
+        size_t next = end + 1;
+
+        invalid += start;
+        if (end > start && buffer[end - 1] == '\r') --end;
+        // skips empty lines and words with invalid characters
+        if (invalid < end)
+            ++discarded;
+        else
+        if (end > start)
+        {
+            Word word = { start, end - start };
+            words.push_back(word);
+        }
+        start = next;
+    }
+
+    return discarded;
+}
+
+
+void WordList::adopt(
+    char *buffer,
+    size_t size,
+    vector<Word> &words,
+    size_t discarded )
+{
+    if (mapped)
+        munmap(this->buffer, capacity);
+    else
+        free(this->buffer);
+
+    mapped = false;
+    this->buffer = buffer;
+    capacity = size;
+    this->words.swap(words);
+    this->discarded = discarded;
+}
+
+
+/**
+ * Compares words in lexicographic order, ignoring the first @c depth characters
+ * (which must be equal in both words).
+ */
+struct WordLess
+{
+    const char *buffer;
+
+    size_t depth;
+
+    bool operator()(
+        const Word &left,
+        const Word &right ) const
+    {
+        int result = memcmp(buffer + left.offset + depth, buffer + right.offset + depth,
+            std::min(left.length, right.length) - depth);
+        return result < 0 || (result == 0 && left.length < right.length);
+    }
+};
+
+
+bool WordList::isSorted() const
+{
+    WordLess less = { buffer, 0 };
+
+    for (size_t i = 1, t = words.size(); i < t; ++i)
+        if (less(words[i], words[i - 1])) return false;
+    return true;
+}
+
+
+void WordList::sort()
+{
+    if (!isSorted()) radixSort();
+}
+
+
+void WordList::putNumber(
+    string &output,
+    size_t value )
+{
+    while (value >= 0x80)
+    {
+        output += (char) ((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    output += (char) value;
+}
+
+
+size_t WordList::getNumber(
+    const char *&input )
+{
+    size_t value = 0;
+    for (size_t shift = 0; ; shift += 7)
+    {
+        unsigned char current = (unsigned char) *input++;
+        value |= (size_t) (current & 0x7F) << shift;
+        if ((current & 0x80) == 0) return value;
+    }
+}
+
+
+void WordList::compress()
+{
+    if (compressed) return;
+
+    coded.clear();
+    blocks.clear();
+    for (size_t i = 0, t = words.size(); i < t; ++i)
+    {
+        const char *current = data(i);
+        size_t length = words[i].length;
+        if (i % BLOCK == 0)
+        {
+            blocks.push_back(coded.length());
+            putNumber(coded, length);
+            coded.append(current, length);
+            continue;
+        }
+
+        const char *previous = data(i - 1);
+        size_t shared = 0;
+        size_t limit = std::min(length, words[i - 1].length);
+        while (shared < limit && current[shared] == previous[shared]) ++shared;
+        putNumber(coded, shared);
+        putNumber(coded, length - shared);
+        coded.append(current + shared, length - shared);
+    }
+    string(coded).swap(coded);
+    total = words.size();
+    compressed = true;
+
+    if (mapped)
+        munmap(buffer, capacity);
+    else
+        free(buffer);
+    buffer = NULL;
+    capacity = 0;
+    mapped = false;
+    vector<Word>().swap(words);
+}
+
+
+size_t WordList::fetch(
+    size_t first,
+    size_t count,
+    const char **data,
+    size_t *lengths,
+    string &scratch ) const
+{
+    if (first >= size()) return 0;
+    count = std::min(count, size() - first);
+
+    if (!compressed)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            data[i] = buffer + words[first + i].offset;
+            lengths[i] = words[first + i].length;
+        }
+        return count;
+    }
+
+    // decodes from the start of the block, since each word depends on the
+    // previous one; the words are stored one after another in 'scratch'
+    scratch.clear();
+    string current;
+    const char *input = coded.data() + blocks[first / BLOCK];
+    for (size_t i = first - first % BLOCK; i < first + count; ++i)
+    {
+        if (i % BLOCK == 0)
+        {
+            size_t length = getNumber(input);
+            current.assign(input, length);
+            input += length;
+        }
+        else
+        {
+            size_t shared = getNumber(input);
+            size_t length = getNumber(input);
+            current.resize(shared);
+            current.append(input, length);
+            input += length;
+        }
+        if (i < first) continue;
+        scratch += current;
+        lengths[i - first] = current.length();
+    }
+
+    const char *position = scratch.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+        data[i] = position;
+        position += lengths[i];
+    }
+    return count;
+}
+
+
+string WordList::word(
+    size_t index ) const
+{
+    if (!compressed) return string(data(index), words[index].length);
+
+    const char *content;
+    size_t length;
+    string scratch;
+    fetch(index, 1, &content, &length, scratch);
+    return scratch;
+}
+
+
+size_t WordList::memory() const
+{
+    if (compressed) return coded.capacity() + blocks.capacity() * sizeof(size_t);
+    return capacity + words.capacity() * sizeof(Word);
+}
+
+
+void WordList::radixSort()
+{
+    // bucket 0 is the end of the word, buckets 1 and 28 are the characters
+    // before 'a' and after 'z' (sorted by comparison)
+    static const size_t BUCKETS = 29;
+    static const size_t THRESHOLD = 32;
+
+    struct Range
+    {
+        size_t first;
+        size_t last;
+        size_t depth;
+    };
+
+    vector<Word> temp(words.size());
+    vector<unsigned char> buckets(words.size());
+    // explicit stack, since the recursion depth would be the length of the
+    // longest common prefix
+    vector<Range> pending;
+    Range range = { 0, words.size(), 0 };
+    pending.push_back(range);
+
+    while (!pending.empty())
+    {
+        range = pending.back();
+        pending.pop_back();
+
+        WordLess less = { buffer, range.depth };
+        if (range.last - range.first < THRESHOLD)
+        {
+            std::sort(words.begin() + range.first, words.begin() + range.last, less);
+            continue;
+        }
+
+        size_t count[BUCKETS] = { 0 };
+        for (size_t i = range.first; i < range.last; ++i)
+        {
+            const Word &word = words[i];
+            size_t bucket = 0;
+            if (range.depth < word.length)
+            {
+                unsigned char current = (unsigned char) buffer[word.offset + range.depth];
+                if (current < 'a')
+                    bucket = 1;
+                else
+                if (current > 'z')
+                    bucket = BUCKETS - 1;
+                else
+                    bucket = (size_t) (current - 'a') + 2;
+            }
+            buckets[i] = (unsigned char) bucket;
+            ++count[bucket];
+        }
+
+        size_t start[BUCKETS];
+        start[0] = range.first;
+        for (size_t i = 1; i < BUCKETS; ++i)
+            start[i] = start[i - 1] + count[i - 1];
+
+        size_t next[BUCKETS];
+        memcpy(next, start, sizeof(next));
+        for (size_t i = range.first; i < range.last; ++i)
+            temp[ next[buckets[i]]++ ] = words[i];
+        std::copy(temp.begin() + range.first, temp.begin() + range.last, words.begin() + range.first);
+
+        // words in bucket 0 are all equal
+        for (size_t i = 1; i < BUCKETS; ++i)
+        {
+            if (count[i] < 2) continue;
+
+            if (i == 1 || i == BUCKETS - 1)
+            {
+                less.depth = range.depth;
+                std::sort(words.begin() + start[i], words.begin() + start[i] + count[i], less);
+            }
+            else
+            {
+                Range child = { start[i], start[i] + count[i], range.depth + 1 };
+                pending.push_back(child);
+            }
+        }
+    }
+}
+
+
+/**
+ * Reads the words of a file sequentially through a buffer, so the file does not
+ * need to fit in memory. Words are normalized as in WordList.
+ */
+class WordReader
+{
+    public:
+        WordReader();
+
+        ~WordReader();
+
+        /**
+         * @brief Opens the given file (reading it from the start if it was
+         * already open).
+         */
+        bool open(
+            const string &fileName );
+
+        /**
+         * @brief Returns the next non-empty line of the file, which is valid
+         * until the next call. Returns @c false at the end of the file.
+         */
+        bool next(
+            const char *&data,
+            size_t &length );
+
+        /**
+         * @brief Returns a boolean value indicating if some read failed.
+         */
+        bool failed() const
+        {
+            return error;
+        }
+
+        /**
+         * @brief Returns the number of lines skipped because of invalid
+         * characters.
+         */
+        size_t discardedCount() const
+        {
+            return discarded;
+        }
+
+    private:
+        static const size_t CAPACITY = 1 << 20;
+
+        int fd;
+
+        char *buffer;
+
+        size_t capacity;
+
+        /**
+         * @brief Position of the first character not returned yet.
+         */
+        size_t start;
+
+        /**
+         * @brief Amount of valid data in the buffer.
+         */
+        size_t end;
+
+        bool eof;
+
+        bool error;
+
+        size_t discarded;
+
+        void close();
+
+        WordReader(
+            const WordReader & );
+
+        WordReader &operator=(
+            const WordReader & );
+};
+
+
+WordReader::WordReader() : fd(-1), buffer(NULL), capacity(0), start(0), end(0),
+    eof(false), error(false), discarded(0)
+{
+}
+
+
+WordReader::~WordReader()
+{
+    close();
+    free(buffer);
+}
+
+
+void WordReader::close()
+{
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+
+bool WordReader::open(
+    const string &fileName )
+{
+    close();
+    fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    if (buffer == NULL)
+    {
+        buffer = (char*) malloc(CAPACITY);
+        if (buffer == NULL) return false;
+        capacity = CAPACITY;
+    }
+
+    #ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    #endif
+    start = end = 0;
+    eof = error = false;
+    discarded = 0;
+    return true;
+}
+
+
+bool WordReader::next(
+    const char *&data,
+    size_t &length )
+{
+    while (true)
+    {
+        char *line = buffer + start;
+        size_t invalid;
+        size_t count = Alphabet::normalize(line, end - start, invalid);
+        bool complete = start + count < end;
+
+        if (!complete && !eof)
+        {
+            // moves the incomplete line to the beginning of the buffer (which
+            // grows if the line does not fit in it) and reads more data
+            memmove(buffer, line, end - start);
+            end -= start;
+            start = 0;
+            if (end == capacity)
+            {
+                char *current = (char*) realloc(buffer, capacity * 2);
+                if (current == NULL) { error = true; return false; }
+                buffer = current;
+                capacity *= 2;
+            }
+
+            ssize_t result = ::read(fd, buffer + end, capacity - end);
+            if (result < 0) error = true;
+            if (result <= 0) eof = true; else end += (size_t) result;
+            continue;
+        }
+
+        // the last line may not have a line break
+        if (start == end) return false;
+
+        start += count + complete;
+        if (count > 0 && line[count - 1] == '\r') --count;
+        // skips empty lines and words with invalid characters
+        if (invalid < count) { ++discarded; continue; }
+        if (count == 0) continue;
+
+        data = line;
+        length = count;
+        return true;
+    }
+}
+
+
+/**
+ * Writes lines to a file (or to the standard output) through a large buffer,
+ * so the file is written in big blocks instead of once per line.
+ */
+class OutputWriter
+{
+    public:
+        OutputWriter();
+
+        ~OutputWriter();
+
+        /**
+         * @brief Opens the given file for writing. The name '-' means the
+         * standard output.
+         */
+        bool open(
+            const string &fileName );
+
+        /**
+         * @brief Appends the given text and a line break.
+         */
+        void writeLine(
+            const char *text,
+            size_t length );
+
+        /**
+         * @brief Appends the given text.
+         */
+        void write(
+            const char *text,
+            size_t length );
+
+        /**
+         * @brief Writes the buffered content.
+         */
+        bool flush();
+
+        /**
+         * @brief Writes the buffered content and closes the file.
+         */
+        bool close();
+
+    private:
+        static const size_t CAPACITY = 1 << 20;
+
+        int fd;
+
+        char *buffer;
+
+        size_t used;
+
+        /**
+         * @brief Indicates if some write failed.
+         */
+        bool failed;
+
+        OutputWriter(
+            const OutputWriter & );
+
+        OutputWriter &operator=(
+            const OutputWriter & );
+};
+
+
+OutputWriter::OutputWriter() : fd(-1), buffer(NULL), used(0), failed(false)
+{
+}
+
+
+OutputWriter::~OutputWriter()
+{
+    close();
+}
+
+
+bool OutputWriter::open(
+    const string &fileName )
+{
+    close();
+
+    if (fileName == "-")
+        fd = STDOUT_FILENO;
+    else
+        fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return false;
+
+    buffer = (char*) malloc(CAPACITY);
+    used = 0;
+    failed = (buffer == NULL);
+    return !failed;
+}
+
+
+void OutputWriter::writeLine(
+    const char *text,
+    size_t length )
+{
+    if (used + length + 1 > CAPACITY)
+    {
+        flush();
+        // lines larger than the buffer are written directly
+        if (length + 1 > CAPACITY)
+        {
+            for (size_t done = 0; done < length && !failed; )
+            {
+                ssize_t count = ::write(fd, text + done, length - done);
+                if (count < 0) failed = true; else done += (size_t) count;
+            }
+            buffer[used++] = '\n';
+            return;
+        }
+    }
+
+    memcpy(buffer + used, text, length);
+    used += length;
+    buffer[used++] = '\n';
+}
+
+
+void OutputWriter::write(
+    const char *text,
+    size_t length )
+{
+    while (length > 0)
+    {
+        if (used == CAPACITY) flush();
+
+        size_t count = std::min(length, CAPACITY - used);
+        memcpy(buffer + used, text, count);
+        used += count;
+        text += count;
+        length -= count;
+    }
+}
+
+
+bool OutputWriter::flush()
+{
+    if (fd < 0) return false;
+
+    for (size_t done = 0; done < used && !failed; )
+    {
+        ssize_t count = ::write(fd, buffer + done, used - done);
+        if (count < 0) failed = true; else done += (size_t) count;
+    }
+    used = 0;
+
+    return !failed;
+}
+
+
+bool OutputWriter::close()
+{
+    if (fd < 0) return false;
+
+    bool result = flush();
+    if (fd != STDOUT_FILENO && ::close(fd) != 0) result = false;
+    free(buffer);
+
+    fd = -1;
+    buffer = NULL;
+    return result;
+}
+
+
+/**
+ * Wall and CPU time (in milliseconds).
+ */
+struct Timing
+{
+    double wall;
+
+    double cpu;
+
+    Timing() : wall(0), cpu(0)
+    {
+    }
+};
+
+
+/**
+ * Work done by a thread of the parallel scan (times in milliseconds).
+ */
+struct WorkerTime
+{
+    /**
+     * @brief Time spent checking words.
+     */
+    double busy;
+
+    /**
+     * @brief Time spent looking for ranges of words to check.
+     */
+    double idle;
+
+    /**
+     * @brief Number of ranges taken from other threads.
+     */
+    size_t steals;
+
+    WorkerTime() : busy(0), idle(0), steals(0)
+    {
+    }
+};
+
+
+/**
+ * Measures the wall time and the CPU time of the process (all threads).
+ */
+class Timer
+{
+    public:
+        Timer()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            clock_gettime(CLOCK_MONOTONIC, &wallStart);
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+        }
+
+        /**
+         * @brief Returns the time elapsed since the last reset.
+         */
+        Timing elapsed() const
+        {
+            Timing result;
+            result.wall = since(CLOCK_MONOTONIC, wallStart);
+            result.cpu = since(CLOCK_PROCESS_CPUTIME_ID, cpuStart);
+            return result;
+        }
+
+    private:
+        struct timespec wallStart;
+
+        struct timespec cpuStart;
+
+        static double since(
+            clockid_t clock,
+            const struct timespec &start )
+        {
+            struct timespec now;
+            clock_gettime(clock, &now);
+            return (double) (now.tv_sec - start.tv_sec) * 1000.0 +
+                (double) (now.tv_nsec - start.tv_nsec) / 1000000.0;
+        }
+};
+
+
+/**
+ * Histogram of non-negative values with buckets of logarithmic width: values
+ * up to 7 have their own bucket and each power of two above it is split in 8
+ * buckets, so percentiles are accurate to 12.5%.
+ */
+class Histogram
+{
+    public:
+        Histogram() : total(0), maximum(0)
+        {
+            memset(buckets, 0, sizeof(buckets));
+        }
+
+        void add(
+            uint64_t value )
+        {
+            ++buckets[bucketOf(value)];
+            ++total;
+            maximum = std::max(maximum, value);
+        }
+
+        void merge(
+            const Histogram &other )
+        {
+            for (size_t i = 0; i < COUNT; ++i)
+                buckets[i] += other.buckets[i];
+            total += other.total;
+            maximum = std::max(maximum, other.maximum);
+        }
+
+        uint64_t count() const
+        {
+            return total;
+        }
+
+        uint64_t largest() const
+        {
+            return maximum;
+        }
+
+        /**
+         * @brief Returns the value below which the given fraction of the values
+         * is (the largest value of its bucket).
+         */
+        uint64_t percentile(
+            double fraction ) const;
+
+    private:
+        static const size_t SUBBUCKETS = 8;
+
+        static const size_t COUNT = 62 * SUBBUCKETS;
+
+        uint64_t buckets[COUNT];
+
+        uint64_t total;
+
+        uint64_t maximum;
+
+        static size_t bucketOf(
+            uint64_t value )
+        {
+            if (value < SUBBUCKETS) return (size_t) value;
+            size_t bits = 63 - (size_t) __builtin_clzll(value);
+            return (bits - 2) * SUBBUCKETS + (size_t) ((value >> (bits - 3)) & (SUBBUCKETS - 1));
+        }
+
+        /**
+         * @brief Returns the smallest value of the given bucket.
+         */
+        static uint64_t lowest(
+            size_t bucket )
+        {
+            if (bucket < SUBBUCKETS) return bucket;
+            size_t bits = bucket / SUBBUCKETS + 2;
+            return (uint64_t) (SUBBUCKETS + bucket % SUBBUCKETS) << (bits - 3);
+        }
+};
+
+
+uint64_t Histogram::percentile(
+    double fraction ) const
+{
+    if (total == 0) return 0;
+    double position = fraction * (double) total;
+    uint64_t rank = (uint64_t) position;
+    if ((double) rank < position || rank == 0) ++rank;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        seen += buckets[i];
+        if (seen < rank) continue;
+        if (i + 1 == COUNT) return maximum;
+        return std::min(lowest(i + 1) - 1, maximum);
+    }
+    return maximum;
+}
+
+
+/**
+ * A word checked while profiling the scan and the work done to check it.
+ */
+struct ProfileEntry
+{
+    string word;
+
+    uint64_t nanoseconds;
+
+    Counters counters;
+};
+
+
+/**
+ * Cost of checking each word of the scan (with '--profile'): histograms of the
+ * time and of the steps taken by each word, and the words which took most
+ * steps. Each thread of the scan fills its own profile and they are merged at
+ * the end.
+ */
+class Profile
+{
+    public:
+        Profile(
+            size_t top = 0 ) : top(top)
+        {
+        }
+
+        /**
+         * @brief Includes a checked word in the profile.
+         */
+        void add(
+            const char *word,
+            size_t length,
+            uint64_t nanoseconds,
+            const Counters &counters );
+
+        void merge(
+            const Profile &other );
+
+        /**
+         * @brief Returns the number of expensive words kept.
+         */
+        size_t limit() const
+        {
+            return top;
+        }
+
+        const Histogram &latency() const
+        {
+            return time;
+        }
+
+        const Histogram &steps() const
+        {
+            return work;
+        }
+
+        /**
+         * @brief Returns the words which took most steps (up to the amount
+         * given to the constructor), from the most expensive one.
+         */
+        vector<ProfileEntry> costliest() const;
+
+        /**
+         * @brief Returns the value of a monotonic clock in nanoseconds.
+         */
+        static uint64_t now()
+        {
+            struct timespec current;
+            clock_gettime(CLOCK_MONOTONIC, &current);
+            return (uint64_t) current.tv_sec * 1000000000 + (uint64_t) current.tv_nsec;
+        }
+
+    private:
+        size_t top;
+
+        Histogram time;
+
+        Histogram work;
+
+        /**
+         * @brief Heap of the most expensive words, with the cheapest of them
+         * at the front.
+         */
+        vector<ProfileEntry> entries;
+
+        /**
+         * @brief Returns a boolean value indicating if the word of @c left took
+         * more steps than the word of @c right (or the same steps and comes
+         * first in lexicographic order, so the result does not depend on the
+         * order the words are checked).
+         */
+        static bool costlier(
+            const ProfileEntry &left,
+            const ProfileEntry &right )
+        {
+            if (left.counters.steps != right.counters.steps)
+                return left.counters.steps > right.counters.steps;
+            return left.word < right.word;
+        }
+
+        void keep(
+            const ProfileEntry &entry );
+};
+
+
+void Profile::add(
+    const char *word,
+    size_t length,
+    uint64_t nanoseconds,
+    const Counters &counters )
+{
+    time.add(nanoseconds);
+    work.add(counters.steps);
+    if (top == 0) return;
+
+    // most words are cheaper than the ones kept, and their text is not copied
+    if (entries.size() == top)
+    {
+        const ProfileEntry &cheapest = entries.front();
+        if (counters.steps < cheapest.counters.steps) return;
+        if (counters.steps == cheapest.counters.steps &&
+            cheapest.word.compare(0, string::npos, word, length) <= 0) return;
+    }
+
+    ProfileEntry entry;
+    entry.word.assign(word, length);
+    entry.nanoseconds = nanoseconds;
+    entry.counters = counters;
+    keep(entry);
+}
+
+
+void Profile::keep(
+    const ProfileEntry &entry )
+{
+    if (entries.size() < top)
+    {
+        entries.push_back(entry);
+        std::push_heap(entries.begin(), entries.end(), costlier);
+        return;
+    }
+    if (!costlier(entry, entries.front())) return;
+
+    std::pop_heap(entries.begin(), entries.end(), costlier);
+    entries.back() = entry;
+    std::push_heap(entries.begin(), entries.end(), costlier);
+}
+
+
+void Profile::merge(
+    const Profile &other )
+{
+    time.merge(other.time);
+    work.merge(other.work);
+    for (size_t i = 0; i < other.entries.size(); ++i)
+        keep(other.entries[i]);
+}
+
+
+vector<ProfileEntry> Profile::costliest() const
+{
+    vector<ProfileEntry> result(entries);
+    std::sort(result.begin(), result.end(), costlier);
+    return result;
+}
+
+
+/**
+ * Information about the execution, printed with the option '--stats'.
+ */
+struct Statistics
+{
+    Timing read;
+
+    Timing normalize;
+
+    Timing sort;
+
+    Timing build;
+
+    Timing scan;
+
+    Timing write;
+
+    size_t words;
+
+    size_t discarded;
+
+    size_t checked;
+
+    size_t compounds;
+
+    size_t nodes;
+
+    size_t memory;
+
+    /**
+     * @brief Number of bytes used by the word list.
+     */
+    size_t wordMemory;
+
+    size_t threads;
+
+    Counters counters;
+
+    /**
+     * @brief Work done by each thread of the parallel scan.
+     */
+    vector<WorkerTime> workers;
+
+    /**
+     * @brief Work done by the read, normalize and build stages of the
+     * pipelined load (without steals).
+     */
+    vector<WorkerTime> stages;
+
+    Statistics() : words(0), discarded(0), checked(0), compounds(0), nodes(0), memory(0),
+        wordMemory(0), threads(1)
+    {
+    }
+};
+
+
+WordList *main_loadWords(
+    const string &fileName,
+    Statistics &statistics )
+{
+    WordList *words = new WordList();
+    Timer timer;
+
+    if (!words->load(fileName))
+    {
+        delete words;
+        return NULL;
+    }
+    statistics.read = timer.elapsed();
+
+    timer.reset();
+    words->split();
+    statistics.normalize = timer.elapsed();
+
+    // ensures the word list is sorted
+    timer.reset();
+    words->sort();
+    statistics.sort = timer.elapsed();
+
+    statistics.words = words->size();
+    statistics.discarded = words->discardedCount();
+    return words;
+}
+
+
+/**
+ * @brief Includes the words from @c first to @c last - 1 of the list in the
+ * graph (with @c Graph::append if @c dawg is @c true).
+ */
+void main_parseRange(
+    Graph &graph,
+    const WordList &words,
+    size_t first,
+    size_t last,
+    bool dawg )
+{
+    static const size_t BATCH = 256;
+    const char *data[BATCH];
+    size_t lengths[BATCH];
+    string scratch;
+
+    for (size_t i = first; i < last; i += BATCH)
+    {
+        size_t count = words.fetch(i, std::min(BATCH, last - i), data, lengths, scratch);
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (dawg)
+                graph.append(data[j], lengths[j]);
+            else
+                graph.parse(data[j], lengths[j]);
+        }
+    }
+}
+
+
+/**
+ * @brief Builds the subtrees of the root taking their first characters from a
+ * shared counter (up to @c last). Each subtree is built in a separate graph.
+ */
+void main_buildShards(
+    const WordList &words,
+    const vector<size_t> *bounds,
+    uint32_t last,
+    std::atomic<uint32_t> *pending,
+    vector<Graph*> *shards )
+{
+    uint32_t symbol;
+    while ((symbol = pending->fetch_add(1)) <= last)
+    {
+        size_t first = (*bounds)[symbol];
+        size_t last = (*bounds)[symbol + 1];
+        if (first == last) continue;
+
+        Graph *shard = new Graph();
+        main_parseRange(*shard, words, first, last, false);
+        (*shards)[symbol] = shard;
+    }
+}
+
+
+/**
+ * @brief Creates the graph including every word of the (sorted) list whose
+ * first character index is in the range [first, last].
+ *
+ * With more than one thread, the subtree of each first character is built in a
+ * separate graph (its words are contiguous in the list) and the graphs are
+ * merged at the end. The minimal automaton is always built by a single thread,
+ * since equivalent nodes may be in different subtrees.
+ */
+void main_build(
+    Graph &root,
+    const WordList &words,
+    bool dawg,
+    size_t threads,
+    uint32_t first = 0,
+    uint32_t last = Alphabet::SIZE - 1 )
+{
+    // position of the first word of each subtree
+    static const size_t BATCH = 256;
+    const char *data[BATCH];
+    size_t lengths[BATCH];
+    string scratch;
+    vector<size_t> bounds(Alphabet::SIZE + 1, words.size());
+    uint32_t following = 0;
+    for (size_t i = 0; i < words.size() && following < Alphabet::SIZE; i += BATCH)
+    {
+        size_t count = words.fetch(i, BATCH, data, lengths, scratch);
+        for (size_t j = 0; j < count; ++j)
+        {
+            uint32_t symbol = Alphabet::symbol((unsigned char) data[j][0]);
+            while (following <= symbol) bounds[following++] = i + j;
+        }
+    }
+
+    if (dawg || threads <= 1)
+    {
+        main_parseRange(root, words, bounds[first], bounds[last + 1], dawg);
+        if (dawg) root.finish();
+        return;
+    }
+
+    // only subtrees with some word get a graph
+    vector<Graph*> shards(Alphabet::SIZE, (Graph*) NULL);
+    std::atomic<uint32_t> pending(first);
+    vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(threads, (size_t) Alphabet::SIZE); ++i)
+        workers.push_back( std::thread(main_buildShards, std::cref(words), &bounds,
+            last, &pending, &shards) );
+    main_buildShards(words, &bounds, last, &pending, &shards);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    for (size_t i = 0; i < Alphabet::SIZE; ++i)
+    {
+        if (shards[i] == NULL) continue;
+        root.merge(*shards[i]);
+        delete shards[i];
+    }
+}
+
+
+/**
+ * @brief Command line options.
+ */
+struct Options
+{
+    const char *inputFile;
+
+    const char *outputFile;
+
+    /**
+     * @brief Number of threads used to find the compound words.
+     */
+    size_t threads;
+
+    /**
+     * @brief Indicates if the graph is built as a minimal automaton.
+     */
+    bool dawg;
+
+    /**
+     * @brief Number of longest compound words to find, visiting the words from
+     * the longest to the shortest (0 to find every compound word).
+     */
+    size_t longest;
+
+    /**
+     * @brief Indicates if execution statistics are printed (0 = no, 1 = text,
+     * 2 = JSON).
+     */
+    int stats;
+
+    /**
+     * @brief Name of the synthetic workload to benchmark (or NULL).
+     */
+    const char *benchmark;
+
+    /**
+     * @brief Number of words generated for each benchmark workload.
+     */
+    size_t benchmarkWords;
+
+    /**
+     * @brief File where the graph is saved after being built (or NULL).
+     */
+    const char *saveIndex;
+
+    /**
+     * @brief File from which the graph is loaded instead of being built from
+     * the input file (or NULL).
+     */
+    const char *loadIndex;
+
+    /**
+     * @brief Indicates if queries are read from the standard input instead of
+     * finding the compound words of the input file.
+     */
+    bool interactive;
+
+    /**
+     * @brief TCP port where queries are accepted instead of finding the compound
+     * words of the input file (0 if not used).
+     */
+    size_t port;
+
+    /**
+     * @brief Shard of the dictionary served by this process and the number of
+     * shards (0 if the whole dictionary is served).
+     */
+    size_t shard;
+
+    size_t shards;
+
+    /**
+     * @brief Comma separated addresses ('host:port') of the shard servers used
+     * to find the compound words of the input file (or NULL).
+     */
+    const char *coordinator;
+
+    /**
+     * @brief Indicates if the input file is read sequentially (twice) instead
+     * of being kept in memory.
+     */
+    bool stream;
+
+    /**
+     * @brief Indicates if the compound words are found walking the graph
+     * instead of checking each word of the list.
+     */
+    bool walk;
+
+    /**
+     * @brief Indicates if failure and output links are added to the graph to
+     * check the words in a single pass.
+     */
+    bool automaton;
+
+    /**
+     * @brief Indicates if words which can not be compound are rejected by a
+     * prefilter before walking the graph.
+     */
+    bool prefilter;
+
+    /**
+     * @brief Indicates if the words are checked using a double-array copy of
+     * the graph.
+     */
+    bool doubleArray;
+
+    /**
+     * @brief Indicates if the word list is kept front-coded in memory.
+     */
+    bool compact;
+
+    /**
+     * @brief Indicates if the input file is read, normalized and included in
+     * the graph by concurrent stages.
+     */
+    bool pipeline;
+
+    /**
+     * @brief Number of most expensive words printed after profiling the cost
+     * of each word checked (0 to not profile the scan).
+     */
+    size_t profile;
+
+    Options() : inputFile(NULL), outputFile(NULL), threads(1), dawg(false),
+        longest(0), stats(0), benchmark(NULL), benchmarkWords(1000000),
+        saveIndex(NULL), loadIndex(NULL), interactive(false), port(0), shard(0), shards(0),
+        coordinator(NULL), stream(false),
+        walk(false), automaton(false), prefilter(false), doubleArray(false),
+        compact(false), pipeline(false), profile(0)
+    {
+    }
+};
+
+
+void main_usage()
+{
+    std::cerr << "Usage: quiz [ options ] <input> [ <output> ]\n"
+        "       quiz [ options ] --load-index <index> [ <input> [ <output> ] ]\n"
+        "       quiz [ options ] --benchmark <workload>\n\n"
+        "<input>   File containing the words. Only ASCII characters accepted (words\n"
+        "          with non-ASCII characters will be ignored).\n"
+        "<output>  Optional output file where the program could save the list of all\n"
+        "          words which are concatenations of other sub-words that exist in the\n"
+        "          input file. Use '-' to write them to the standard output (the\n"
+        "          other messages are then written to the standard error).\n\n"
+        "Options:\n"
+        "  --threads <n>   Number of threads used to find the compound words. Use 0\n"
+        "                  to use one thread per available core (default is 1).\n"
+        "  --dawg          Build the graph as a minimal automaton, sharing the nodes\n"
+        "                  of equivalent suffixes (uses less memory).\n"
+        "  --longest <k>   Only find the <k> longest compound words, checking words\n"
+        "                  from the longest to the shortest. The output file will\n"
+        "                  contain only these words.\n"
+        "  --stats         Print the time spent in each phase and other counters\n"
+        "                  to the standard error. Use '--stats=json' to print them\n"
+        "                  in JSON format.\n"
+        "  --benchmark <workload>\n"
+        "                  Build the graph and find the compound words of a generated\n"
+        "                  dictionary, printing the throughput. The workload can be\n"
+        "                  'uniform', 'prefixes', 'compounds', 'zipf' or 'all'.\n"
+        "  --words <n>     Number of words generated for benchmarks (default is\n"
+        "                  1000000).\n"
+        "  --save-index <index>\n"
+        "                  Save the graph in a binary file after building it.\n"
+        "  --load-index <index>\n"
+        "                  Load the graph from a binary file created with the option\n"
+        "                  '--save-index' instead of building it. The words of the\n"
+        "                  input file (if any) are checked against the graph, but\n"
+        "                  not included in it. Without input file (or with '-' as\n"
+        "                  the input file) the words of the graph itself are checked.\n"
+        "  --interactive   Build the graph and answer queries read from the standard\n"
+        "                  input, one per line:\n"
+        "                    check <word>      'yes' if the word is compound\n"
+        "                    split <word>      sub-words of the word (or '-')\n"
+        "                    splits <word>     every way to split the word in\n"
+        "                                      sub-words (up to 100, or '-')\n"
+        "                    longest <prefix>  longest compound word in the graph\n"
+        "                                      starting with the prefix (or '-')\n"
+        "                    add <word>        include the word in the graph\n"
+        "                    remove <word>     remove the word from the graph\n"
+        "                    compounds         number of compound words\n"
+        "                  The last three need a prefix tree built without\n"
+        "                  '--automaton', '--prefilter' or '--double-array' (not\n"
+        "                  a loaded index).\n"
+        "  --listen <port> Like '--interactive', but answers queries of clients\n"
+        "                  connected to the given TCP port.\n"
+        "  --shard <k>/<n> With '--interactive' or '--listen', only include in the\n"
+        "                  graph the words of the shard <k> (from 0) of <n>: the\n"
+        "                  first characters are split in <n> contiguous ranges\n"
+        "                  (not available with '--load-index').\n"
+        "                  Two more queries are answered:\n"
+        "                    shard             the shard served, as '<k>/<n>'\n"
+        "                    find <text>       every word of the shard in the text,\n"
+        "                                      as '<position>:<length>' (or '-')\n"
+        "  --coordinator <host>:<port>[,<host>:<port>...]\n"
+        "                  Find the compound words of the input file using the\n"
+        "                  shard servers at the given addresses (the shard <k> of\n"
+        "                  <n> must be the address <k>), without building a graph.\n"
+        "  --stream        Include the words in the graph while reading the input\n"
+        "                  file and read it again to find the compound words, so\n"
+        "                  the word list is never kept in memory. The compound words\n"
+        "                  are written in the order of the input file (which must be\n"
+        "                  sorted when using '--dawg'). Not available with\n"
+        "                  '--longest'.\n"
+        "  --walk          Find the compound words walking the graph, which shares\n"
+        "                  the work done for common prefixes (the word list is\n"
+        "                  released after building the graph). Not available with\n"
+        "                  '--longest'. This is the default when loading a graph\n"
+        "                  without input file.\n"
+        "  --automaton     Add failure and output links (Aho-Corasick) to the graph,\n"
+        "                  so each word is checked in a single pass over it. Not\n"
+        "                  available with '--dawg' or '--walk'.\n"
+        "  --prefilter     Reject words which can not be compound (by their length,\n"
+        "                  first and last characters and a Bloom filter of the\n"
+        "                  words) before walking the graph. Not available with\n"
+        "                  '--walk'.\n"
+        "  --double-array  Check the words using a double-array (base and check)\n"
+        "                  copy of the graph, where each transition is a single\n"
+        "                  read of a contiguous array. Not available with '--dawg',\n"
+        "                  '--walk' or '--automaton'.\n"
+        "  --compact       Keep the word list front-coded in memory (each word only\n"
+        "                  stores what differs from the previous one) instead of\n"
+        "                  keeping the input file. The time spent is included in\n"
+        "                  the sort phase.\n"
+        "  --pipeline      Read the input file, normalize the words and include them\n"
+        "                  in the graph at the same time, in separate threads (the\n"
+        "                  graph is built by a single thread, and the input file\n"
+        "                  must be sorted when using '--dawg'). Not available with\n"
+        "                  '--stream' or '--load-index'.\n"
+        "  --profile <n>   Measure the time and the steps taken to check each word\n"
+        "                  and print their percentiles and the <n> words which took\n"
+        "                  most steps to the standard error. The words are checked\n"
+        "                  one at a time, so the scan is slower. Not available with\n"
+        "                  '--walk', '--coordinator', '--benchmark' or when\n"
+        "                  answering queries.\n\n";
+}
+
+
+bool main_parseNumber(
+    const char *text,
+    size_t &value )
+{
+    char *end = NULL;
+    long number = strtol(text, &end, 10);
+    if (*end != 0 || end == text || number < 0) return false;
+    value = (size_t) number;
+    return true;
+}
+
+
+bool main_parseOptions(
+    int argc,
+    char **argv,
+    Options &options )
+{
+    size_t count = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string current = argv[i];
+
+        if (current == "--threads" && i + 1 < argc)
+        {
+            if (!main_parseNumber(argv[++i], options.threads)) return false;
+            if (options.threads == 0)
+                options.threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+        else
+        if (current == "--dawg")
+            options.dawg = true;
+        else
+        if (current == "--stats")
+            options.stats = 1;
+        else
+        if (current == "--stats=json")
+            options.stats = 2;
+        else
+        if (current == "--benchmark" && i + 1 < argc)
+            options.benchmark = argv[++i];
+        else
+        if (current == "--interactive")
+            options.interactive = true;
+        else
+        if (current == "--stream")
+            options.stream = true;
+        else
+        if (current == "--walk")
+            options.walk = true;
+        else
+        if (current == "--automaton")
+            options.automaton = true;
+        else
+        if (current == "--prefilter")
+            options.prefilter = true;
+        else
+        if (current == "--double-array")
+            options.doubleArray = true;
+        else
+        if (current == "--compact")
+            options.compact = true;
+        else
+        if (current == "--pipeline")
+            options.pipeline = true;
+        else
+        if (current == "--listen" && i + 1 < argc)
+        {
+            if (!main_parseNumber(argv[++i], options.port)) return false;
+            if (options.port == 0 || options.port > 65535) return false;
+        }
+        else
+        if (current == "--shard" && i + 1 < argc)
+        {
+            string value = argv[++i];
+            size_t slash = value.find('/');
+            if (slash == string::npos) return false;
+            if (!main_parseNumber(value.substr(0, slash).c_str(), options.shard) ||
+                !main_parseNumber(value.substr(slash + 1).c_str(), options.shards)) return false;
+            if (options.shards == 0 || options.shards > Alphabet::SIZE || options.shard >= options.shards)
+                return false;
+        }
+        else
+        if (current == "--coordinator" && i + 1 < argc)
+            options.coordinator = argv[++i];
+        else
+        if (current == "--save-index" && i + 1 < argc)
+            options.saveIndex = argv[++i];
+        else
+        if (current == "--load-index" && i + 1 < argc)
+            options.loadIndex = argv[++i];
+        else
+        if (current == "--words" && i + 1 < argc)
+        {
+            if (!main_parseNumber(argv[++i], options.benchmarkWords)) return false;
+        }
+        else
+        if (current == "--longest" && i + 1 < argc)
+        {
+            if (!main_parseNumber(argv[++i], options.longest)) return false;
+            if (options.longest == 0) return false;
+        }
+        else
+        if (current == "--profile" && i + 1 < argc)
+        {
+            if (!main_parseNumber(argv[++i], options.profile)) return false;
+            if (options.profile == 0) return false;
+        }
+        else
+        if (current.compare(0, 2, "--") == 0)
+            return false;
+        else
+        if (count == 0)
+            options.inputFile = argv[i], ++count;
+        else
+        if (count == 1)
+            options.outputFile = argv[i], ++count;
+        else
+            return false;
+    }
+
+    if (options.automaton && (options.dawg || options.walk)) return false;
+    if (options.prefilter && options.walk) return false;
+    if (options.doubleArray && (options.dawg || options.walk || options.automaton)) return false;
+    // only the scans checking each word can be profiled
+    if (options.profile != 0 && (options.walk || options.coordinator != NULL ||
+        options.benchmark != NULL || options.interactive || options.port != 0)) return false;
+    if (options.pipeline && (options.stream || options.loadIndex != NULL || options.coordinator != NULL))
+        return false;
+    // shards only answer queries (and are built from the input file, since a
+    // loaded graph is never split), and the coordinator has no graph
+    if (options.shards != 0 && (options.loadIndex != NULL || (!options.interactive && options.port == 0)))
+        return false;
+    if (options.coordinator != NULL)
+        return options.inputFile != NULL && options.benchmark == NULL && options.loadIndex == NULL &&
+            options.saveIndex == NULL && !options.interactive && options.port == 0 &&
+            options.longest == 0 && !options.walk;
+    if (options.benchmark != NULL) return count == 0;
+    if (options.walk && options.longest != 0) return false;
+    if (options.stream) return options.inputFile != NULL && options.longest == 0;
+    return options.inputFile != NULL || options.loadIndex != NULL;
+}
+
+
+/**
+ * @brief Returns the shard (of @c count) owning the words starting with the
+ * given character index.
+ */
+size_t main_shardOf(
+    uint32_t symbol,
+    size_t count )
+{
+    return (size_t) symbol * count / Alphabet::SIZE;
+}
+
+
+/**
+ * @brief Finds the range of first character indices of the words included in
+ * the graph (every character index if the whole dictionary is used).
+ */
+void main_shardSymbols(
+    const Options &options,
+    uint32_t &first,
+    uint32_t &last )
+{
+    first = 0;
+    last = Alphabet::SIZE - 1;
+    if (options.shards == 0) return;
+
+    while (main_shardOf(first, options.shards) < options.shard) ++first;
+    last = first;
+    while (last + 1 < Alphabet::SIZE && main_shardOf(last + 1, options.shards) == options.shard) ++last;
+}
+
+
+/**
+ * @brief Compound words found in a range of the word list.
+ */
+struct ScanResult
+{
+    /**
+     * @brief Position of the first word of the range.
+     */
+    size_t first;
+
+    /**
+     * @brief Indices (in the order they were checked) of the compound words.
+     */
+    vector<size_t> compounds;
+
+    /**
+     * @brief Index of the first longest compound word (or the end of the
+     * range if there is no compound word in it).
+     */
+    size_t longest;
+
+    /**
+     * @brief Number of words checked.
+     */
+    size_t checked;
+
+    Counters counters;
+
+    ScanResult() : first(0), longest(0), checked(0)
+    {
+    }
+};
+
+
+/**
+ * @brief Finds the compound words in the range [first, last) of the word list.
+ *
+ * If @c order is not NULL, the range refers to positions in this array, which
+ * contains the indices of the words to check. If @c profile is not NULL, the
+ * words are checked one at a time and the cost of each one is included in it.
+ */
+void main_scanRange(
+    const Graph &root,
+    const WordList &words,
+    const size_t *order,
+    size_t first,
+    size_t last,
+    ScanResult &result,
+    Profile *profile = NULL )
+{
+    size_t length = 0;
+
+    result.first = first;
+    result.longest = last;
+    result.checked += last - first;
+    // the words are checked in batches, so the graph is walked for many words
+    // at once
+    static const size_t BATCH = 64;
+    const char *data[BATCH];
+    size_t lengths[BATCH];
+    bool compound[BATCH];
+    string scratch[BATCH];
+
+    for (size_t i = first; i < last; i += BATCH)
+    {
+        size_t count = std::min(BATCH, last - i);
+        if (order == NULL)
+            words.fetch(i, count, data, lengths, scratch[0]);
+        else
+        {
+            // the words are not contiguous in the list, so each one is got
+            // separately
+            for (size_t j = 0; j < count; ++j)
+                words.fetch(order[i + j], 1, &data[j], &lengths[j], scratch[j]);
+        }
+
+        // the current words are composed of other words in the list?
+        if (profile == NULL)
+            root.isCompoundWords(data, lengths, count, compound, &result.counters);
+        else
+        {
+            for (size_t j = 0; j < count; ++j)
+            {
+                Counters counters;
+                uint64_t start = Profile::now();
+                compound[j] = root.isCompoundWord(data[j], lengths[j], &counters);
+                profile->add(data[j], lengths[j], Profile::now() - start, counters);
+                result.counters += counters;
+            }
+        }
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (!compound[j]) continue;
+
+            size_t index = (order == NULL) ? i + j : order[i + j];
+            result.compounds.push_back(index);
+            // checks if the current word is the longest until now
+            if (lengths[j] > length)
+            {
+                result.longest = index;
+                length = lengths[j];
+            }
+        }
+    }
+}
+
+
+/**
+ * Ranges of the word list waiting to be checked by a thread of the parallel
+ * scan. The owner takes ranges from the back and the other threads steal them
+ * from the front, where the largest ranges are.
+ */
+class RangeDeque
+{
+    public:
+        void push(
+            size_t first,
+            size_t last )
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ranges.push_back( std::make_pair(first, last) );
+        }
+
+        bool pop(
+            size_t &first,
+            size_t &last )
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (ranges.empty()) return false;
+            first = ranges.back().first;
+            last = ranges.back().second;
+            ranges.pop_back();
+            return true;
+        }
+
+        bool steal(
+            size_t &first,
+            size_t &last )
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (ranges.empty()) return false;
+            first = ranges.front().first;
+            last = ranges.front().second;
+            ranges.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex lock;
+
+        std::deque< std::pair<size_t, size_t> > ranges;
+};
+
+
+/**
+ * @brief Checks ranges of words taken from the deque of the thread (or stolen
+ * from the other ones) until every word of the scan is checked.
+ *
+ * Large ranges are split lazily: the upper half goes back to the deque and the
+ * lower half is split again, until it is small enough to be checked at once.
+ * So threads which run out of work steal large ranges, and only the ranges
+ * actually checked are small.
+ */
+void main_scanWorker(
+    const Graph &root,
+    const WordList &words,
+    const size_t *order,
+    vector<RangeDeque> *deques,
+    size_t self,
+    std::atomic<size_t> *remaining,
+    vector<ScanResult> *results,
+    WorkerTime *time,
+    Profile *profile )
+{
+    static const size_t GRAIN = 256;
+
+    RangeDeque &own = (*deques)[self];
+    size_t count = deques->size();
+    Timer total;
+    double busy = 0;
+
+    while (remaining->load() > 0)
+    {
+        size_t first;
+        size_t last;
+        bool found = own.pop(first, last);
+        for (size_t i = 1; !found && i < count; ++i)
+        {
+            found = (*deques)[(self + i) % count].steal(first, last);
+            if (found) ++time->steals;
+        }
+        if (!found)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        Timer timer;
+        while (last - first > GRAIN)
+        {
+            size_t middle = first + (last - first) / 2;
+            own.push(middle, last);
+            last = middle;
+        }
+        results->push_back(ScanResult());
+        main_scanRange(root, words, order, first, last, results->back(), profile);
+        remaining->fetch_sub(last - first);
+        busy += timer.elapsed().wall;
+    }
+
+    time->busy += busy;
+    time->idle += total.elapsed().wall - busy;
+}
+
+
+/**
+ * @brief Orders scan results by the position of their ranges.
+ */
+bool main_compareResults(
+    const ScanResult &left,
+    const ScanResult &right )
+{
+    return left.first < right.first;
+}
+
+
+/**
+ * @brief Finds the compound words of the list checking it concurrently (the
+ * graph is read-only at this point).
+ *
+ * Each thread starts with a contiguous part of the list and steals ranges from
+ * the other threads when it finishes, so words with very different costs do
+ * not leave threads idle. The results of each range are kept apart and merged
+ * in order, so the output is the same regardless of the number of threads.
+ * If @c workers is not NULL, the work done by each thread is added to it (and
+ * the same for the cost of each word and @c profile).
+ */
+void main_scan(
+    const Graph &root,
+    const WordList &words,
+    const size_t *order,
+    size_t first,
+    size_t last,
+    size_t threads,
+    vector<ScanResult> &results,
+    vector<WorkerTime> *workers = NULL,
+    Profile *profile = NULL )
+{
+    size_t total = last - first;
+    if (threads > total) threads = std::max(total, (size_t) 1);
+
+    results.clear();
+    vector<WorkerTime> times(threads);
+    if (threads == 1)
+    {
+        Timer timer;
+        results.resize(1);
+        main_scanRange(root, words, order, first, last, results[0], profile);
+        times[0].busy = timer.elapsed().wall;
+    }
+    else
+    {
+        vector<RangeDeque> deques(threads);
+        for (size_t i = 0; i < threads; ++i)
+            deques[i].push(first + total * i / threads, first + total * (i + 1) / threads);
+
+        std::atomic<size_t> remaining(total);
+        vector< vector<ScanResult> > partial(threads);
+        vector<Profile> profiles;
+        if (profile != NULL) profiles.assign(threads, Profile(profile->limit()));
+        vector<std::thread> pool;
+        for (size_t i = 1; i < threads; ++i)
+            pool.push_back( std::thread(main_scanWorker, std::cref(root), std::cref(words),
+                order, &deques, i, &remaining, &partial[i], &times[i],
+                profile == NULL ? NULL : &profiles[i]) );
+        main_scanWorker(root, words, order, &deques, 0, &remaining, &partial[0], &times[0],
+            profile == NULL ? NULL : &profiles[0]);
+        for (size_t i = 0; i < pool.size(); ++i)
+            pool[i].join();
+        for (size_t i = 0; i < profiles.size(); ++i)
+            profile->merge(profiles[i]);
+
+        for (size_t i = 0; i < threads; ++i)
+            for (size_t j = 0; j < partial[i].size(); ++j)
+            {
+                results.push_back(ScanResult());
+                std::swap(results.back(), partial[i][j]);
+            }
+        std::sort(results.begin(), results.end(), main_compareResults);
+    }
+
+    if (workers == NULL) return;
+    if (workers->size() < threads) workers->resize(threads);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        (*workers)[i].busy += times[i].busy;
+        (*workers)[i].idle += times[i].idle;
+        (*workers)[i].steals += times[i].steals;
+    }
+}
+
+
+/**
+ * @brief Finds the @c count longest compound words of the list.
+ *
+ * The words are grouped by length (keeping the lexicographic order inside each
+ * group) and the groups are checked from the longest words to the shortest ones.
+ * The search stops after the group where the requested amount of compound words
+ * is reached, so usually only a small part of the list is checked.
+ */
+void main_scanLongest(
+    const Graph &root,
+    const WordList &words,
+    size_t count,
+    size_t threads,
+    ScanResult &result,
+    vector<WorkerTime> *workers = NULL,
+    Profile *profile = NULL )
+{
+    size_t total = words.size();
+
+    // the lengths are got sequentially, since the list may be compressed
+    static const size_t BATCH = 256;
+    vector<size_t> lengths(total + 1);
+    const char *data[BATCH];
+    string scratch;
+    for (size_t i = 0; i < total; i += BATCH)
+        words.fetch(i, BATCH, data, &lengths[i], scratch);
+
+    // counting sort of the word indices by decreasing length
+    size_t maximum = 0;
+    for (size_t i = 0; i < total; ++i)
+        maximum = std::max(maximum, lengths[i]);
+
+    vector<size_t> start(maximum + 2, 0);
+    for (size_t i = 0; i < total; ++i)
+        ++start[ maximum - lengths[i] + 1 ];
+    for (size_t i = 1; i < start.size(); ++i)
+        start[i] += start[i - 1];
+
+    vector<size_t> order(total);
+    vector<size_t> next(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < total; ++i)
+        order[ next[maximum - lengths[i]]++ ] = i;
+
+    result.compounds.clear();
+    result.checked = 0;
+    for (size_t i = 0; i <= maximum && result.compounds.size() < count; ++i)
+    {
+        if (start[i] == start[i + 1]) continue;
+
+        vector<ScanResult> partial;
+        main_scan(root, words, &order[0], start[i], start[i + 1], threads, partial, workers,
+            profile);
+        for (size_t j = 0; j < partial.size(); ++j)
+        {
+            result.compounds.insert(result.compounds.end(), partial[j].compounds.begin(),
+                partial[j].compounds.end());
+            result.checked += partial[j].checked;
+            result.counters += partial[j].counters;
+        }
+    }
+
+    if (result.compounds.size() > count) result.compounds.resize(count);
+    result.longest = result.compounds.empty() ? total : result.compounds[0];
+}
+
+
+/**
+ * Pseudo-random number generator (xorshift64*) used by the benchmarks, so the
+ * generated dictionaries are the same in every run.
+ */
+class Random
+{
+    public:
+        Random(
+            uint64_t seed ) : state(seed)
+        {
+        }
+
+        uint64_t next()
+        {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545F4914F6CDD1DULL;
+        }
+
+        /**
+         * @brief Returns a number in the range [0, limit).
+         */
+        size_t uniform(
+            size_t limit )
+        {
+            return (size_t) (next() % limit);
+        }
+
+        /**
+         * @brief Returns a number in the range [first, last].
+         */
+        size_t uniform(
+            size_t first,
+            size_t last )
+        {
+            return first + uniform(last - first + 1);
+        }
+
+    private:
+        uint64_t state;
+};
+
+
+void bench_randomWord(
+    Random &random,
+    size_t length,
+    size_t letters,
+    string &output )
+{
+    for (size_t i = 0; i < length; ++i)
+        output += (char) ('a' + random.uniform(letters));
+}
+
+
+/**
+ * @brief Random letters with uniformly distributed lengths (3 to 12).
+ */
+void bench_uniform(
+    size_t count,
+    string &text )
+{
+    Random random(1);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        bench_randomWord(random, random.uniform(3, 12), 26, text);
+        text += '\n';
+    }
+}
+
+
+/**
+ * @brief Heavy shared prefixes: every run of 'a' up to 64 characters, plus long
+ * words of 'a' with a few other letters (each of them has many splits and
+ * needs to try almost all of them).
+ */
+void bench_prefixes(
+    size_t count,
+    string &text )
+{
+    Random random(2);
+
+    for (size_t i = 1; i <= 64 && i <= count; ++i)
+        text.append(i, 'a').append(1, '\n');
+
+    for (size_t i = 64; i < count; ++i)
+    {
+        size_t length = random.uniform(16, 64);
+        for (size_t j = 0; j < length; ++j)
+            text += (random.uniform(16) == 0) ? (char) ('b' + random.uniform(3)) : 'a';
+        text += '\n';
+    }
+}
+
+
+/**
+ * @brief A base vocabulary (10% of the words) and long compounds made of 2 to 6
+ * words of the vocabulary.
+ */
+void bench_compounds(
+    size_t count,
+    string &text )
+{
+    Random random(3);
+
+    vector<string> base(std::max(count / 10, (size_t) 1));
+    for (size_t i = 0; i < base.size(); ++i)
+    {
+        bench_randomWord(random, random.uniform(2, 10), 26, base[i]);
+        text.append(base[i]).append(1, '\n');
+    }
+
+    for (size_t i = base.size(); i < count; ++i)
+    {
+        for (size_t j = 0, t = random.uniform(2, 6); j < t; ++j)
+            text += base[ random.uniform(base.size()) ];
+        text += '\n';
+    }
+}
+
+
+/**
+ * @brief Random letters with Zipf-distributed lengths (2 to 64 characters, most
+ * of them short).
+ */
+void bench_zipf(
+    size_t count,
+    string &text )
+{
+    static const size_t LENGTHS = 63;
+    Random random(4);
+
+    // cumulative distribution for the ranks 1 to LENGTHS (exponent 1)
+    double total = 0;
+    double cumulative[LENGTHS];
+    for (size_t i = 0; i < LENGTHS; ++i)
+        cumulative[i] = (total += 1.0 / (double) (i + 1));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        double sample = (double) (random.next() >> 11) / (double) (1ULL << 53) * total;
+        size_t rank = (size_t) (std::lower_bound(cumulative, cumulative + LENGTHS, sample) - cumulative);
+        bench_randomWord(random, std::min(rank, LENGTHS - 1) + 2, 26, text);
+        text += '\n';
+    }
+}
+
+
+/**
+ * @brief Generates a dictionary, builds the graph and finds all compound words,
+ * printing the throughput of each phase.
+ */
+void bench_run(
+    const Options &options,
+    const char *name,
+    void (*generate)(size_t, string &) )
+{
+    string text;
+    generate(options.benchmarkWords, text);
+
+    WordList words;
+    words.assign(text);
+    string().swap(text);
+    words.split();
+    words.sort();
+
+    size_t characters = 0;
+    for (size_t i = 0; i < words.size(); ++i)
+        characters += words.length(i);
+
+    Timer timer;
+    Graph root;
+    main_build(root, words, options.dawg, options.threads);
+    if (options.automaton) root.buildLinks();
+    if (options.prefilter) root.buildFilter();
+    if (options.doubleArray) root.buildDoubleArray();
+    Timing build = timer.elapsed();
+
+    timer.reset();
+    vector<ScanResult> results;
+    main_scan(root, words, NULL, 0, words.size(), options.threads, results);
+    Timing scan = timer.elapsed();
+
+    size_t compounds = 0;
+    Counters counters;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        compounds += results[i].compounds.size();
+        counters += results[i].counters;
+    }
+
+    double seconds = std::max(scan.wall, 1e-6) / 1000.0;
+    std::ios::fmtflags flags = std::cout.flags();
+    std::cout << std::fixed << std::setprecision(1)
+        << std::setw(10) << std::left << name << std::right
+        << std::setw(10) << words.size()
+        << std::setw(10) << root.size()
+        << std::setw(10) << compounds
+        << std::setw(11) << build.wall
+        << std::setw(11) << scan.wall
+        << std::setw(12) << std::setprecision(0) << (double) words.size() / seconds
+        << std::setw(9) << std::setprecision(2) << scan.wall * 1000000.0 / (double) std::max(characters, (size_t) 1)
+        << std::setw(11) << (double) counters.steps / (double) std::max(characters, (size_t) 1)
+        << std::endl;
+    std::cout.flags(flags);
+}
+
+
+int main_benchmark(
+    const Options &options )
+{
+    static const char *names[] = { "uniform", "prefixes", "compounds", "zipf" };
+    static void (*generators[])(size_t, string &) = { bench_uniform, bench_prefixes,
+        bench_compounds, bench_zipf };
+
+    string selected = options.benchmark;
+    if (selected != "all" && std::find(names, names + 4, selected) == names + 4)
+    {
+        std::cerr << "Unknown benchmark workload '" << selected << "'" << std::endl;
+        return 1;
+    }
+
+    std::cout << "workload       words     nodes compounds   build ms    scan ms     words/s  ns/char  steps/char" << std::endl;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (selected == "all" || selected == names[i])
+            bench_run(options, names[i], generators[i]);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Set of the compound words of a graph, kept up to date while words are
+ * added to or removed from the graph.
+ *
+ * Every split gained or lost by a change uses the changed word as one of its
+ * parts, so only the words containing it need to be checked again (instead of
+ * scanning the whole graph).
+ */
+class CompoundSet
+{
+    public:
+        /**
+         * @brief Includes every compound word of the given graph.
+         */
+        void build(
+            const Graph &graph );
+
+        /**
+         * @brief Updates the set after the given word was added to or removed
+         * from the graph. Returns the number of compound words included or
+         * removed.
+         */
+        size_t update(
+            const Graph &graph,
+            const string &word );
+
+        size_t size() const;
+
+    private:
+        std::unordered_set<string> words;
+
+        friend struct CompoundBuilder;
+        friend struct CompoundUpdater;
+};
+
+
+/**
+ * Includes the compound words visited by @c Graph::scan in a set.
+ */
+struct CompoundBuilder
+{
+    CompoundSet &set;
+
+    void operator()(
+        const string &word,
+        bool compound )
+    {
+        if (compound) set.words.insert(word);
+    }
+};
+
+
+/**
+ * Checks again the words visited by @c Graph::enumerateContaining, updating
+ * the set.
+ */
+struct CompoundUpdater
+{
+    const Graph &graph;
+
+    CompoundSet &set;
+
+    size_t changes;
+
+    void operator()(
+        const string &word )
+    {
+        bool compound = graph.isCompoundWord(word.c_str(), word.length());
+        if (compound)
+            changes += set.words.insert(word).second ? 1 : 0;
+        else
+            changes += set.words.erase(word);
+    }
+};
+
+
+void CompoundSet::build(
+    const Graph &graph )
+{
+    words.clear();
+    CompoundBuilder visitor = { *this };
+    graph.scan(0, Alphabet::SIZE - 1, visitor);
+}
+
+
+size_t CompoundSet::update(
+    const Graph &graph,
+    const string &word )
+{
+    // a removed word is not visited, since it is not in the graph anymore
+    CompoundUpdater visitor = { graph, *this, 0 };
+    if (!graph.contains(word.c_str(), word.length()))
+        visitor.changes += words.erase(word);
+    graph.enumerateContaining(word.c_str(), word.length(), visitor);
+    return visitor.changes;
+}
+
+
+size_t CompoundSet::size() const
+{
+    return words.size();
+}
+
+
+/**
+ * @brief State shared by the queries of the interactive and server modes.
+ *
+ * Queries may run in parallel (one thread per client), but a change to the
+ * graph waits for them and blocks them until it is done.
+ */
+struct Session
+{
+    Graph &root;
+
+    /**
+     * @brief Compound words of the graph (only if it is editable), found by
+     * the first query which needs them.
+     */
+    CompoundSet compounds;
+
+    bool built;
+
+    bool editable;
+
+    /**
+     * @brief Shard of the dictionary in the graph, as '<k>/<n>'.
+     */
+    string shard;
+
+    pthread_rwlock_t lock;
+
+    Session(
+        Graph &root );
+
+    ~Session();
+
+    private:
+        Session(
+            const Session & );
+
+        Session &operator=(
+            const Session & );
+};
+
+
+Session::Session(
+    Graph &root ) : root(root), built(false), editable(root.isEditable()), shard("0/1")
+{
+    pthread_rwlock_init(&lock, NULL);
+}
+
+
+Session::~Session()
+{
+    pthread_rwlock_destroy(&lock);
+}
+
+
+/**
+ * Counts the words visited by @c Graph::enumerate.
+ */
+struct WordCounter
+{
+    size_t count;
+
+    void operator()(
+        const string & )
+    {
+        ++count;
+    }
+};
+
+
+/**
+ * @brief Returns the given parts of a word separated by spaces.
+ */
+string main_joinParts(
+    const string &word,
+    const vector<Span> &parts )
+{
+    string result;
+
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        if (i > 0) result += ' ';
+        result.append(word, parts[i].offset, parts[i].length);
+    }
+    return result;
+}
+
+
+/**
+ * @brief Answers a query which does not change the graph.
+ */
+string main_answer(
+    const Session &session,
+    const string &command,
+    const string &value )
+{
+    const Graph &root = session.root;
+
+    if ((command == "check" || command == "split" || command == "splits") && value.empty())
+        return "error: missing word";
+
+    if (command == "check")
+        return root.isCompoundWord(value) ? "yes" : "no";
+
+    if (command == "split")
+    {
+        vector<Span> parts;
+        if (!root.split(value.c_str(), value.length(), parts)) return "-";
+        return main_joinParts(value, parts);
+    }
+
+    if (command == "splits")
+    {
+        vector< vector<Span> > splits;
+        if (root.splitAll(value.c_str(), value.length(), splits, 100) == 0) return "-";
+
+        string result;
+        for (size_t i = 0; i < splits.size(); ++i)
+            result += (i > 0 ? ", " : "") + main_joinParts(value, splits[i]);
+        return result;
+    }
+
+    if (command == "longest")
+    {
+        string result;
+        if (!root.longestCompoundWord(value.c_str(), value.length(), result)) return "-";
+        return result;
+    }
+
+    if (command == "find")
+    {
+        vector<Span> matches;
+        root.findWords(value.c_str(), value.length(), matches);
+        if (matches.empty()) return "-";
+
+        std::ostringstream result;
+        for (size_t i = 0; i < matches.size(); ++i)
+            result << (i > 0 ? " " : "") << matches[i].offset << ':' << matches[i].length;
+        return result.str();
+    }
+
+    if (command == "shard") return session.shard;
+
+    if (command == "words")
+    {
+        WordCounter counter = { 0 };
+        root.enumerate("", 0, counter);
+        std::ostringstream result;
+        result << counter.count;
+        return result.str();
+    }
+
+    return "error: unknown command '" + command + "'";
+}
+
+
+/**
+ * @brief Answers a query which uses the compound words of the graph: a change
+ * ('add' or 'remove') or 'compounds'. The compound words are found the first
+ * time, so the sessions which never need them do not pay for the scan.
+ */
+string main_update(
+    Session &session,
+    const string &command,
+    const string &value )
+{
+    if (!session.editable)
+    {
+        if (command == "compounds") return "error: the compound words are only kept for editable graphs";
+        return "error: the graph can not be changed (it must be a prefix tree built without '--automaton', '--prefilter' or '--double-array', and not a shard)";
+    }
+
+    Graph &root = session.root;
+    if (!session.built)
+    {
+        session.compounds.build(root);
+        session.built = true;
+    }
+
+    if (command == "compounds")
+    {
+        std::ostringstream result;
+        result << session.compounds.size();
+        return result.str();
+    }
+
+    if (value.empty()) return "error: missing word";
+    if (command == "add")
+    {
+        if (root.contains(value.c_str(), value.length())) return "error: the word is already in the graph";
+        root.parse(value.c_str(), value.length());
+        // 'parse' ignores words with invalid characters
+        if (!root.contains(value.c_str(), value.length())) return "error: invalid word";
+    }
+    else
+    {
+        if (!root.remove(value.c_str(), value.length())) return "error: the word is not in the graph";
+    }
+
+    size_t changes = session.compounds.update(root, value);
+    std::ostringstream result;
+    result << (command == "add" ? "added" : "removed") << " (" << changes << " compound words changed, "
+        << session.compounds.size() << " in total)";
+    return result.str();
+}
+
+
+/**
+ * @brief Answers a query of the interactive mode. The result is the response
+ * without line break.
+ */
+string main_query(
+    Session &session,
+    const string &line )
+{
+    // the word is the rest of the line, since the byte alphabet allows spaces
+    size_t separator = line.find(' ');
+    string command = line.substr(0, separator);
+    string value;
+    if (separator != string::npos) value = line.substr(separator + 1);
+
+    size_t invalid;
+    if (!value.empty()) Alphabet::normalize(&value[0], value.length(), invalid);
+
+    if (command == "add" || command == "remove" || command == "compounds")
+    {
+        pthread_rwlock_wrlock(&session.lock);
+        string result = main_update(session, command, value);
+        pthread_rwlock_unlock(&session.lock);
+        return result;
+    }
+
+    pthread_rwlock_rdlock(&session.lock);
+    string result = main_answer(session, command, value);
+    pthread_rwlock_unlock(&session.lock);
+    return result;
+}
+
+
+/**
+ * @brief Answers queries read from the standard input until its end (or the
+ * command 'quit').
+ */
+void main_interactive(
+    Session &session )
+{
+    string line;
+
+    while (std::getline(std::cin, line))
+    {
+        if (!line.empty() && line[line.length() - 1] == '\r') line.resize(line.length() - 1);
+        if (line.empty()) continue;
+        if (line == "quit") break;
+
+        std::cout << main_query(session, line) << '\n' << std::flush;
+    }
+}
+
+
+/**
+ * @brief Answers the queries of a client until it disconnects (or sends the
+ * command 'quit').
+ */
+void main_serveClient(
+    Session &session,
+    int client )
+{
+    string pending;
+    char buffer[4096];
+
+    while (true)
+    {
+        ssize_t count = ::read(client, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) break;
+        pending.append(buffer, (size_t) count);
+
+        // answers every complete line at once
+        string responses;
+        size_t start = 0;
+        size_t end;
+        bool quit = false;
+        while (!quit && (end = pending.find('\n', start)) != string::npos)
+        {
+            string line = pending.substr(start, end - start);
+            start = end + 1;
+
+            if (!line.empty() && line[line.length() - 1] == '\r') line.resize(line.length() - 1);
+            if (line.empty()) continue;
+            if (line == "quit")
+                quit = true;
+            else
+                responses.append(main_query(session, line)).append(1, '\n');
+        }
+        pending.erase(0, start);
+
+        // a client which disconnects must not kill the server with SIGPIPE
+        for (size_t done = 0; done < responses.length(); )
+        {
+            ssize_t written = send(client, responses.data() + done, responses.length() - done,
+                MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) { quit = true; break; }
+            done += (size_t) written;
+        }
+        if (quit) break;
+    }
+
+    ::close(client);
+}
+
+
+/**
+ * @brief Accepts clients in the given TCP port and answers their queries, each
+ * client in its own thread.
+ */
+int main_listen(
+    Session &session,
+    size_t port )
+{
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0)
+    {
+        std::cerr << "Can not create the server socket" << std::endl;
+        return 1;
+    }
+
+    int enable = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t) port);
+
+    if (bind(server, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(server, 64) != 0)
+    {
+        std::cerr << "Can not listen in the port " << port << std::endl;
+        ::close(server);
+        return 1;
+    }
+    std::cout << "Listening in the port " << port << std::endl;
+
+    while (true)
+    {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) continue;
+        std::thread(main_serveClient, std::ref(session), client).detach();
+    }
+}
+
+
+void main_printTiming(
+    const char *name,
+    const Timing &timing,
+    bool json )
+{
+    if (json)
+        std::cerr << "\"" << name << "\": { \"wall_ms\": " << timing.wall << ", \"cpu_ms\": "
+            << timing.cpu << " }";
+    else
+        std::cerr << "  " << std::setw(10) << std::left << name << std::right << std::setw(12)
+            << timing.wall << " ms wall" << std::setw(12) << timing.cpu << " ms cpu" << std::endl;
+}
+
+
+void main_printStatistics(
+    const Statistics &statistics,
+    bool json )
+{
+    const char *names[] = { "read", "normalize", "sort", "build", "scan", "write" };
+    const Timing *timings[] = { &statistics.read, &statistics.normalize, &statistics.sort,
+        &statistics.build, &statistics.scan, &statistics.write };
+
+    std::ios::fmtflags flags = std::cerr.flags();
+    std::cerr << std::fixed << std::setprecision(3);
+
+    if (json)
+    {
+        std::cerr << "{ \"phases\": { ";
+        for (size_t i = 0; i < 6; ++i)
+        {
+            if (i > 0) std::cerr << ", ";
+            main_printTiming(names[i], *timings[i], true);
+        }
+        std::cerr << " }, \"threads\": " << statistics.threads
+            << ", \"words\": " << statistics.words
+            << ", \"discarded\": " << statistics.discarded
+            << ", \"checked\": " << statistics.checked
+            << ", \"compounds\": " << statistics.compounds
+            << ", \"nodes\": " << statistics.nodes
+            << ", \"graph_bytes\": " << statistics.memory
+            << ", \"words_bytes\": " << statistics.wordMemory
+            << ", \"steps\": " << statistics.counters.steps
+            << ", \"restarts\": " << statistics.counters.restarts
+            << ", \"filtered\": " << statistics.counters.filtered << ", \"workers\": [ ";
+        for (size_t i = 0; i < statistics.workers.size(); ++i)
+        {
+            const WorkerTime &worker = statistics.workers[i];
+            if (i > 0) std::cerr << ", ";
+            std::cerr << "{ \"busy_ms\": " << worker.busy << ", \"idle_ms\": " << worker.idle
+                << ", \"steals\": " << worker.steals << " }";
+        }
+        std::cerr << " ], \"stages\": [ ";
+        for (size_t i = 0; i < statistics.stages.size(); ++i)
+        {
+            const WorkerTime &stage = statistics.stages[i];
+            if (i > 0) std::cerr << ", ";
+            std::cerr << "{ \"name\": \"" << names[i == 2 ? 3 : i] << "\", \"busy_ms\": "
+                << stage.busy << ", \"idle_ms\": " << stage.idle << " }";
+        }
+        std::cerr << " ] }" << std::endl;
+    }
+    else
+    {
+        std::cerr << "Statistics:" << std::endl;
+        for (size_t i = 0; i < 6; ++i)
+            main_printTiming(names[i], *timings[i], false);
+        std::cerr << "  threads   " << statistics.threads << std::endl
+            << "  words     " << statistics.words << std::endl
+            << "  discarded " << statistics.discarded << std::endl
+            << "  checked   " << statistics.checked << std::endl
+            << "  compounds " << statistics.compounds << std::endl
+            << "  nodes     " << statistics.nodes << std::endl
+            << "  graph     " << statistics.memory << " bytes" << std::endl
+            << "  word list " << statistics.wordMemory << " bytes" << std::endl
+            << "  steps     " << statistics.counters.steps << std::endl
+            << "  restarts  " << statistics.counters.restarts << std::endl
+            << "  filtered  " << statistics.counters.filtered << std::endl;
+        for (size_t i = 0; i < statistics.workers.size(); ++i)
+        {
+            const WorkerTime &worker = statistics.workers[i];
+            std::cerr << "  worker " << std::setw(2) << std::left << i << std::right
+                << " busy " << std::setw(10) << worker.busy << " ms, idle " << std::setw(10)
+                << worker.idle << " ms, " << worker.steals << " steals" << std::endl;
+        }
+        for (size_t i = 0; i < statistics.stages.size(); ++i)
+        {
+            const WorkerTime &stage = statistics.stages[i];
+            std::cerr << "  stage " << std::setw(10) << std::left << names[i == 2 ? 3 : i]
+                << std::right << " busy " << std::setw(10) << stage.busy << " ms, idle "
+                << std::setw(10) << stage.idle << " ms" << std::endl;
+        }
+    }
+
+    std::cerr.flags(flags);
+}
+
+
+/**
+ * @brief Writes the given text as a JSON string (with the byte alphabet, words
+ * may have quotes or control characters).
+ */
+void main_writeJson(
+    ostream &output,
+    const string &text )
+{
+    static const char *DIGITS = "0123456789abcdef";
+
+    output << '"';
+    for (size_t i = 0; i < text.length(); ++i)
+    {
+        unsigned char current = (unsigned char) text[i];
+        if (current == '"' || current == '\\')
+            output << '\\' << text[i];
+        else
+        if (current < 0x20)
+            output << "\\u00" << DIGITS[current >> 4] << DIGITS[current & 15];
+        else
+            output << text[i];
+    }
+    output << '"';
+}
+
+
+/**
+ * @brief Prints the percentiles of the time and of the steps taken to check
+ * each word and the words which took most steps.
+ */
+void main_printProfile(
+    const Profile &profile,
+    bool json )
+{
+    static const double FRACTIONS[] = { 0.5, 0.95, 0.99, 0.999 };
+    static const char *NAMES[] = { "p50", "p95", "p99", "p999" };
+    const Histogram *histograms[] = { &profile.latency(), &profile.steps() };
+    const char *kinds[] = { "latency_ns", "steps" };
+    vector<ProfileEntry> entries = profile.costliest();
+
+    if (json)
+    {
+        std::cerr << "{ \"profile\": { \"words\": " << profile.latency().count();
+        for (size_t i = 0; i < 2; ++i)
+        {
+            std::cerr << ", \"" << kinds[i] << "\": { ";
+            for (size_t j = 0; j < 4; ++j)
+                std::cerr << "\"" << NAMES[j] << "\": " << histograms[i]->percentile(FRACTIONS[j]) << ", ";
+            std::cerr << "\"max\": " << histograms[i]->largest() << " }";
+        }
+        std::cerr << ", \"costliest\": [ ";
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            const ProfileEntry &entry = entries[i];
+            if (i > 0) std::cerr << ", ";
+            std::cerr << "{ \"word\": ";
+            main_writeJson(std::cerr, entry.word);
+            std::cerr << ", \"steps\": " << entry.counters.steps
+                << ", \"restarts\": " << entry.counters.restarts << ", \"latency_ns\": "
+                << entry.nanoseconds << " }";
+        }
+        std::cerr << " ] } }" << std::endl;
+        return;
+    }
+
+    std::cerr << "Profile of " << profile.latency().count() << " words:" << std::endl;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        std::cerr << "  " << std::setw(12) << std::left << (i == 0 ? "latency (ns)" : "steps")
+            << std::right;
+        for (size_t j = 0; j < 4; ++j)
+            std::cerr << " " << NAMES[j] << " " << std::setw(8) << std::left
+                << histograms[i]->percentile(FRACTIONS[j]) << std::right;
+        std::cerr << " max " << histograms[i]->largest() << std::endl;
+    }
+    std::cerr << "  words with most steps:" << std::endl;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const ProfileEntry &entry = entries[i];
+        std::cerr << "  " << std::setw(10) << entry.counters.steps << " steps "
+            << std::setw(8) << entry.counters.restarts << " restarts "
+            << std::setw(10) << entry.nanoseconds << " ns  " << entry.word << std::endl;
+    }
+}
+
+
+/**
+ * @brief Prints the longest compound word and its sub-words.
+ */
+void main_printLongest(
+    ostream &report,
+    const string &longest,
+    const vector<Span> &parts )
+{
+    report << std::endl << "The longest compound word is '" << longest << "'" << std::endl << std::endl;
+    report << "Sub-words of '" << longest << "':" << std::endl << "    ";
+    report << main_joinParts(longest, parts) << std::endl;
+}
+
+
+void main_printLongest(
+    ostream &report,
+    const Graph &root,
+    const string &longest )
+{
+    vector<Span> parts;
+    root.split(longest.c_str(), longest.length(), parts);
+    main_printLongest(report, longest, parts);
+}
+
+
+/**
+ * @brief Prints the preparation and processing times.
+ */
+void main_printTimes(
+    ostream &report,
+    const Statistics &statistics )
+{
+    double dataTime = statistics.read.wall + statistics.normalize.wall + statistics.sort.wall;
+    double processTime = statistics.build.wall + statistics.scan.wall + statistics.write.wall;
+    report << std::endl << std::fixed << std::setprecision(3);
+    report << "Preparation time: " << dataTime << " ms" << std::endl;
+    report << " Processing time: " << processTime << " ms" << std::endl;
+}
+
+
+OutputWriter *main_openOutput(
+    const Options &options )
+{
+    if (options.outputFile == NULL) return NULL;
+
+    OutputWriter *output = new OutputWriter();
+    if (!output->open(options.outputFile))
+    {
+        delete output;
+        output = NULL;
+    }
+    return output;
+}
+
+
+/**
+ * @brief Writes the compound words of the scan results, in order.
+ *
+ * The words are got in batches, starting at the first word not got yet, so a
+ * compressed list is decoded sequentially when the compound words are in the
+ * order of the list.
+ */
+void main_writeCompounds(
+    OutputWriter &output,
+    const WordList &words,
+    const vector<ScanResult> &results )
+{
+    static const size_t BATCH = 256;
+    const char *data[BATCH];
+    size_t lengths[BATCH];
+    string scratch;
+    size_t first = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const vector<size_t> &compounds = results[i].compounds;
+        for (size_t j = 0; j < compounds.size(); ++j)
+        {
+            size_t index = compounds[j];
+            if (index < first || index >= first + count)
+            {
+                first = index;
+                count = words.fetch(first, BATCH, data, lengths, scratch);
+            }
+            output.writeLine(data[index - first], lengths[index - first]);
+        }
+    }
+}
+
+
+/**
+ * Lines of the input file passed between the stages of the pipelined load:
+ * the content from @c first to @c last - 1 of the buffer and, after being
+ * normalized, the words found in it.
+ */
+struct Chunk
+{
+    size_t first;
+
+    size_t last;
+
+    vector<Word> words;
+
+    size_t discarded;
+
+    Chunk() : first(0), last(0), discarded(0)
+    {
+    }
+};
+
+
+/**
+ * Bounded lock-free queue of chunks with a single producer and a single
+ * consumer. A full (or empty) queue makes the thread yield until the other
+ * one catches up, so a slow stage holds back the ones before it.
+ */
+class ChunkQueue
+{
+    public:
+        ChunkQueue() : head(0), tail(0)
+        {
+        }
+
+        /**
+         * @brief Adds a chunk to the queue (NULL indicates the last one),
+         * waiting while the queue is full.
+         */
+        void push(
+            Chunk *chunk )
+        {
+            size_t position = tail.load(std::memory_order_relaxed);
+            while (position - head.load(std::memory_order_acquire) == CAPACITY)
+                std::this_thread::yield();
+            slots[position % CAPACITY] = chunk;
+            tail.store(position + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Removes the oldest chunk of the queue, waiting while the queue
+         * is empty.
+         */
+        Chunk *pop()
+        {
+            size_t position = head.load(std::memory_order_relaxed);
+            while (tail.load(std::memory_order_acquire) == position)
+                std::this_thread::yield();
+            Chunk *chunk = slots[position % CAPACITY];
+            head.store(position + 1, std::memory_order_release);
+            return chunk;
+        }
+
+    private:
+        static const size_t CAPACITY = 16;
+
+        Chunk *slots[CAPACITY];
+
+        /**
+         * @brief Number of chunks removed (only changed by the consumer).
+         */
+        std::atomic<size_t> head;
+
+        /**
+         * @brief Number of chunks added (only changed by the producer).
+         */
+        std::atomic<size_t> tail;
+
+        ChunkQueue(
+            const ChunkQueue & );
+
+        ChunkQueue &operator=(
+            const ChunkQueue & );
+};
+
+
+/**
+ * State of a stage of the pipelined load (times in milliseconds).
+ */
+struct PipelineStage
+{
+    /**
+     * @brief Time spent working on chunks (the rest of the time the stage
+     * was waiting for the other stages).
+     */
+    double busy;
+
+    /**
+     * @brief Time elapsed since the start of the load until the stage
+     * handled its last chunk.
+     */
+    Timing finished;
+
+    bool failed;
+
+    PipelineStage() : busy(0), failed(false)
+    {
+    }
+};
+
+
+/**
+ * @brief Reads the file into @c buffer (which has room for @c size bytes),
+ * passing each block of whole lines to the normalizer as soon as it is read.
+ */
+void main_readChunks(
+    int fd,
+    char *buffer,
+    size_t size,
+    size_t *used,
+    ChunkQueue *output,
+    const Timer *start,
+    PipelineStage *stage )
+{
+    static const size_t BLOCK = 1 << 16;
+    size_t first = 0;
+    size_t end = 0;
+
+    while (end < size)
+    {
+        Timer timer;
+        ssize_t count = ::read(fd, buffer + end, std::min(BLOCK, size - end));
+        if (count < 0) stage->failed = true;
+        if (count <= 0) break;
+        end += (size_t) count;
+
+        // the last line of the block waits for the rest of it
+        size_t last = end;
+        while (last > first && buffer[last - 1] != '\n') --last;
+        stage->busy += timer.elapsed().wall;
+        if (last == first) continue;
+
+        Chunk *chunk = new Chunk();
+        chunk->first = first;
+        chunk->last = first = last;
+        output->push(chunk);
+    }
+    if (first < end)
+    {
+        Chunk *chunk = new Chunk();
+        chunk->first = first;
+        chunk->last = end;
+        output->push(chunk);
+    }
+
+    *used = end;
+    stage->finished = start->elapsed();
+    output->push(NULL);
+}
+
+
+/**
+ * @brief Normalizes the lines of each chunk and finds its words.
+ */
+void main_normalizeChunks(
+    char *buffer,
+    ChunkQueue *input,
+    ChunkQueue *output,
+    const Timer *start,
+    PipelineStage *stage )
+{
+    Chunk *chunk;
+    while ((chunk = input->pop()) != NULL)
+    {
+        Timer timer;
+        chunk->discarded = WordList::splitLines(buffer, chunk->first, chunk->last, chunk->words);
+        stage->busy += timer.elapsed().wall;
+        output->push(chunk);
+    }
+
+    stage->finished = start->elapsed();
+    output->push(NULL);
+}
+
+
+/**
+ * @brief Includes the words of each chunk whose first character index is in
+ * the range [first, last] in the graph, keeping every word in @c words.
+ *
+ * The minimal automaton requires the words to be in order: if some word is
+ * not, the stage fails (but keeps taking chunks, so the others can finish).
+ */
+void main_buildChunks(
+    const char *buffer,
+    bool dawg,
+    uint32_t first,
+    uint32_t last,
+    ChunkQueue *input,
+    Graph *root,
+    vector<Word> *words,
+    size_t *discarded,
+    const Timer *start,
+    PipelineStage *stage )
+{
+    WordLess less = { buffer, 0 };
+    // last word included in the minimal automaton (which may be in a
+    // previous chunk)
+    Word previous = { 0, 0 };
+    bool included = false;
+    Chunk *chunk;
+    while ((chunk = input->pop()) != NULL)
+    {
+        Timer timer;
+        for (size_t i = 0; i < chunk->words.size() && !stage->failed; ++i)
+        {
+            const Word &word = chunk->words[i];
+            uint32_t symbol = Alphabet::symbol((unsigned char) buffer[word.offset]);
+            if (symbol < first || symbol > last) continue;
+            if (!dawg)
+            {
+                root->parse(buffer + word.offset, word.length);
+                continue;
+            }
+            if (included && less(word, previous))
+            {
+                stage->failed = true;
+                continue;
+            }
+            root->append(buffer + word.offset, word.length);
+            previous = word;
+            included = true;
+        }
+        words->insert(words->end(), chunk->words.begin(), chunk->words.end());
+        *discarded += chunk->discarded;
+        stage->busy += timer.elapsed().wall;
+        delete chunk;
+    }
+    if (dawg && !stage->failed) root->finish();
+
+    stage->finished = start->elapsed();
+}
+
+
+/**
+ * @brief Loads the words of the input file and builds the graph at the same
+ * time: a thread reads the file, another one normalizes the lines and finds
+ * the words, and the current thread includes them in the graph. The stages are
+ * connected by bounded queues, so reading the file overlaps the work done with
+ * the data already read.
+ *
+ * The words are only sorted after building the graph. The scan only starts
+ * after that, since a word may have sub-words starting with any character.
+ * Input which is not a regular file is loaded and built one phase at a time.
+ * Errors are reported to the standard error.
+ */
+WordList *main_loadPipelined(
+    const Options &options,
+    Graph &root,
+    Statistics &statistics )
+{
+    uint32_t first;
+    uint32_t last;
+    main_shardSymbols(options, first, last);
+
+    int fd = open(options.inputFile, O_RDONLY);
+    struct stat info;
+    if (fd >= 0 && (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0))
+    {
+        close(fd);
+        fd = -1;
+        WordList *words = main_loadWords(options.inputFile, statistics);
+        if (words == NULL)
+        {
+            std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+            return NULL;
+        }
+        Timer timer;
+        main_build(root, *words, options.dawg, options.threads, first, last);
+        statistics.build = timer.elapsed();
+        return words;
+    }
+    size_t size = fd < 0 ? 0 : (size_t) info.st_size;
+    char *buffer = fd < 0 ? NULL : (char*) malloc(size);
+    if (buffer == NULL)
+    {
+        if (fd >= 0) close(fd);
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return NULL;
+    }
+    #ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    #endif
+
+    Timer start;
+    ChunkQueue lines;
+    ChunkQueue normalized;
+    PipelineStage stages[3];
+    size_t used = 0;
+    vector<Word> found;
+    size_t discarded = 0;
+    std::thread reader(main_readChunks, fd, buffer, size, &used, &lines, &start, &stages[0]);
+    std::thread normalizer(main_normalizeChunks, buffer, &lines, &normalized, &start, &stages[1]);
+    main_buildChunks(buffer, options.dawg, first, last, &normalized, &root, &found, &discarded,
+        &start, &stages[2]);
+    reader.join();
+    normalizer.join();
+    close(fd);
+
+    // each phase only counts the time after the previous one finished
+    const Timing *finished[] = { &stages[0].finished, &stages[1].finished, &stages[2].finished };
+    Timing *phases[] = { &statistics.read, &statistics.normalize, &statistics.build };
+    Timing previous;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        phases[i]->wall = std::max(finished[i]->wall - previous.wall, 0.0);
+        phases[i]->cpu = std::max(finished[i]->cpu - previous.cpu, 0.0);
+        previous = *finished[i];
+
+        WorkerTime time;
+        time.busy = stages[i].busy;
+        time.idle = std::max(finished[i]->wall - stages[i].busy, 0.0);
+        statistics.stages.push_back(time);
+    }
+
+    WordList *words = new WordList();
+    words->adopt(buffer, used, found, discarded);
+    if (stages[0].failed)
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        delete words;
+        return NULL;
+    }
+    if (stages[2].failed)
+    {
+        std::cerr << "The input file must be sorted to use '--dawg' with '--pipeline'" << std::endl;
+        delete words;
+        return NULL;
+    }
+
+    // ensures the word list is sorted
+    Timer timer;
+    words->sort();
+    statistics.sort = timer.elapsed();
+
+    statistics.words = words->size();
+    statistics.discarded = words->discardedCount();
+    return words;
+}
+
+
+/**
+ * @brief Builds the graph including the words while reading the input file.
+ */
+bool main_streamBuild(
+    const Options &options,
+    Graph &root,
+    Statistics &statistics )
+{
+    WordReader reader;
+    if (!reader.open(options.inputFile))
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return false;
+    }
+
+    uint32_t first;
+    uint32_t last;
+    main_shardSymbols(options, first, last);
+
+    Timer timer;
+    const char *data;
+    size_t length;
+    string previous;
+    while (reader.next(data, length))
+    {
+        uint32_t symbol = Alphabet::symbol((unsigned char) data[0]);
+        if (symbol < first || symbol > last) continue;
+        ++statistics.words;
+        if (!options.dawg)
+        {
+            root.parse(data, length);
+            continue;
+        }
+
+        // the minimal automaton can only be built from sorted words
+        if (previous.compare(0, string::npos, data, length) > 0)
+        {
+            std::cerr << "The input file must be sorted to use '--dawg' with '--stream'" << std::endl;
+            return false;
+        }
+        previous.assign(data, length);
+        root.append(data, length);
+    }
+    if (options.dawg) root.finish();
+    statistics.build = timer.elapsed();
+    statistics.discarded = reader.discardedCount();
+
+    if (reader.failed())
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Adds the requested optional structures (failure and output links,
+ * prefilter, double array) to the graph.
  */
-class Node
+bool main_buildExtras(
+    const Options &options,
+    Graph &root,
+    Statistics &statistics )
 {
-    public:
-        Node();
+    Timer timer;
+    const char *failed = NULL;
+    if (options.automaton && !root.buildLinks()) failed = "--automaton";
+    if (options.doubleArray && !root.buildDoubleArray()) failed = "--double-array";
+    if (options.prefilter) root.buildFilter();
+    Timing elapsed = timer.elapsed();
+    statistics.build.wall += elapsed.wall;
+    statistics.build.cpu += elapsed.cpu;
 
-        Node(
-            const string &word );
+    if (failed != NULL)
+        std::cerr << "The option '" << failed << "' can only be used with a prefix tree" << std::endl;
+    return failed == NULL;
+}
 
-        ~Node();
 
-        /**
-         * @brief Build the graph
-         */
-        void parse(
-            const string &value,
-            size_t position = 0 );
+/**
+ * @brief Finds the compound words reading the input file again.
+ */
+int main_streamScan(
+    const Options &options,
+    const Graph &root,
+    Statistics &statistics )
+{
+    WordReader reader;
+    if (!reader.open(options.inputFile))
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return 1;
+    }
 
-        /**
-         * @brief Returns a boolean value indicating if the given word is made up
-         * of words in the graph.
-         */
-        bool isCompoundWord(
-            const string &word,
-            set<string> *output ) const;
+    bool piped = (options.outputFile != NULL && string(options.outputFile) == "-");
+    ostream &report = piped ? std::cerr : std::cout;
+    OutputWriter *output = main_openOutput(options);
 
-    private:
-        /**
-         * @brief If the current node is a terminal, this field stores the word
-         * with which this node matches.
-         */
-        string word;
+    Timer timer;
+    const char *data;
+    size_t length;
+    string longest;
+    Profile profile(options.profile);
+    while (reader.next(data, length))
+    {
+        ++statistics.checked;
+        if (options.profile != 0)
+        {
+            Counters counters;
+            uint64_t start = Profile::now();
+            bool compound = root.isCompoundWord(data, length, &counters);
+            profile.add(data, length, Profile::now() - start, counters);
+            statistics.counters += counters;
+            if (!compound) continue;
+        }
+        else
+        if (!root.isCompoundWord(data, length, &statistics.counters)) continue;
 
-        /**
-         * @brief Indicates if the current node is a terminal.
-         */
-        bool isTerminal;
+        ++statistics.compounds;
+        if (output != NULL) output->writeLine(data, length);
+        // checks if the current word is the longest until now
+        if (length > longest.length()) longest.assign(data, length);
+    }
+    statistics.scan = timer.elapsed();
+    if (options.loadIndex != NULL)
+    {
+        statistics.words = statistics.checked;
+        statistics.discarded = reader.discardedCount();
+    }
 
-        /**
-         * @brief Pointers to 'next' nodes for each valid character ('a' to 'z').
-         */
-        Node *next[26];
+    timer.reset();
+    if (output != NULL && !output->close())
+        std::cerr << "Can not write the compound words to '" << options.outputFile << "'" << std::endl;
+    statistics.write = timer.elapsed();
+    delete output;
 
-        /**
-         * @brief Returns a boolean value indicating if the given word is made up
-         * of words in the graph.
-         *
-         * This function traverses the graph looking for sub-words which
-         * the given word is composed. The return value is @c true only if every
-         * sub-word of the given word is in the list.
-         */
-        bool isCompoundWord(
-            const char *word,
-            size_t position,
-            const Node *root,
-            set<string> *output ) const;
-};
+    if (reader.failed())
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return 1;
+    }
+
+    main_printLongest(report, root, longest);
+    main_printTimes(report, statistics);
+    if (options.stats != 0) main_printStatistics(statistics, options.stats == 2);
+    if (options.profile != 0) main_printProfile(profile, options.stats == 2);
+    return 0;
+}
 
 
-Node::Node() : isTerminal(false)
+/**
+ * @brief Compound words found walking a subtree of the graph.
+ */
+struct WalkResult
 {
-    memset(next, 0, sizeof(next));
-}
+    /**
+     * @brief Compound words, one per line.
+     */
+    string compounds;
+
+    size_t count;
+
+    /**
+     * @brief First longest compound word.
+     */
+    string longest;
+
+    size_t checked;
+
+    Counters counters;
+
+    WalkResult() : count(0), checked(0)
+    {
+    }
+
+    void operator()(
+        const string &word,
+        bool compound )
+    {
+        ++checked;
+        if (!compound) return;
 
+        ++count;
+        compounds.append(word).append(1, '\n');
+        if (word.length() > longest.length()) longest = word;
+    }
+};
 
-Node::Node(
-    const string &word ) : word(word), isTerminal(false)
+
+/**
+ * @brief Walks the subtrees of the root taking them from a shared counter, so
+ * threads which got small subtrees take more of them.
+ */
+void main_walkSubtrees(
+    const Graph &root,
+    std::atomic<uint32_t> *pending,
+    vector<WalkResult> *results )
 {
-    memset(next, 0, sizeof(next));
+    uint32_t symbol;
+    while ((symbol = pending->fetch_add(1)) < Alphabet::SIZE)
+    {
+        WalkResult &result = (*results)[symbol];
+        root.scan(symbol, symbol, result, &result.counters);
+    }
 }
 
 
-Node::~Node()
+/**
+ * @brief Finds the compound words walking the graph, each subtree of the root
+ * in a separate task. The results are merged in alphabetical order.
+ */
+int main_walkScan(
+    const Options &options,
+    const Graph &root,
+    Statistics &statistics )
 {
-    for (size_t i = 0; i < 26; ++i)
-        if (next[i] != NULL) delete next[i];
+    bool piped = (options.outputFile != NULL && string(options.outputFile) == "-");
+    ostream &report = piped ? std::cerr : std::cout;
+    OutputWriter *output = main_openOutput(options);
+
+    Timer timer;
+    vector<WalkResult> results(Alphabet::SIZE);
+    std::atomic<uint32_t> pending(0);
+    vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(options.threads, (size_t) Alphabet::SIZE); ++i)
+        workers.push_back( std::thread(main_walkSubtrees, std::cref(root), &pending, &results) );
+    main_walkSubtrees(root, &pending, &results);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    statistics.scan = timer.elapsed();
+
+    timer.reset();
+    string longest;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const WalkResult &result = results[i];
+
+        if (output != NULL) output->write(result.compounds.data(), result.compounds.length());
+        if (result.longest.length() > longest.length()) longest = result.longest;
+
+        statistics.checked += result.checked;
+        statistics.compounds += result.count;
+        statistics.counters += result.counters;
+    }
+    if (output != NULL && !output->close())
+        std::cerr << "Can not write the compound words to '" << options.outputFile << "'" << std::endl;
+    statistics.write = timer.elapsed();
+    delete output;
+
+    main_printLongest(report, root, longest);
+    main_printTimes(report, statistics);
+    if (options.stats != 0) main_printStatistics(statistics, options.stats == 2);
+    return 0;
 }
 
 
-void Node::parse(
-    const string &value,
-    size_t position )
+/**
+ * @brief Connection of the coordinator to a shard server.
+ */
+struct ShardConnection
 {
-    char current = value[position];
+    string address;
+
+    int socket;
 
-    if (current < 'a' || current > 'z') return;
+    /**
+     * @brief Queries of the current round, one per line.
+     */
+    string requests;
 
-    int index = current - 97;
+    /**
+     * @brief Number of bytes of @c requests already sent.
+     */
+    size_t written;
+
+    /**
+     * @brief Number of responses of the current round not received yet.
+     */
+    size_t pending;
+
+    /**
+     * @brief Responses received in the current round, one per line.
+     */
+    string responses;
+
+    /**
+     * @brief Position in the current round of the word of each query.
+     */
+    vector<size_t> words;
+};
+
+
+/**
+ * @brief Connects to a TCP server given as 'host:port'. Returns the socket or
+ * -1 on failure.
+ */
+int main_connect(
+    const string &address )
+{
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) return -1;
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
 
-    if (next[index] == NULL)
-        next[index] = new Node();
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *found = NULL;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) return -1;
 
-    if (value[position + 1] != 0)
+    int result = -1;
+    for (struct addrinfo *current = found; current != NULL && result < 0; current = current->ai_next)
     {
-        #if (DEBUG_PARSE == 1)
-        if (next[index]->isTerminal)
-            std::cout << current << ' ';
-        else
-            std::cout << (char)(current + 32) << ' ';
-        #endif
-        next[index]->parse(value, position + 1);
+        result = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
+        if (result < 0) continue;
+        if (connect(result, current->ai_addr, current->ai_addrlen) != 0)
+        {
+            ::close(result);
+            result = -1;
+        }
     }
-    else
+    freeaddrinfo(found);
+    return result;
+}
+
+
+/**
+ * @brief Sends the queries of the current round to every shard and receives
+ * their responses.
+ *
+ * The queries and the responses are transferred at the same time (waiting
+ * with 'poll'), so a shard never blocks writing responses which are not read
+ * while the coordinator is still sending queries.
+ */
+bool main_exchange(
+    vector<ShardConnection> &shards )
+{
+    vector<struct pollfd> events(shards.size());
+    char buffer[65536];
+
+    while (true)
     {
-        next[index]->isTerminal = true;
-        next[index]->word = value;
-        #if (DEBUG_PARSE == 1)
-        std::cout << current << " = " << next[index]->word << std::endl;
-        #endif
+        size_t waiting = 0;
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            const ShardConnection &shard = shards[i];
+            events[i].fd = shard.socket;
+            events[i].events = 0;
+            events[i].revents = 0;
+            if (shard.written < shard.requests.length()) events[i].events |= POLLOUT;
+            if (shard.pending > 0) events[i].events |= POLLIN;
+            if (events[i].events != 0) ++waiting;
+        }
+        if (waiting == 0) return true;
+        if (poll(&events[0], (nfds_t) events.size(), -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            ShardConnection &shard = shards[i];
+            if ((events[i].revents & (POLLERR | POLLNVAL)) != 0) return false;
+
+            // a shard which exits is reported as an error instead of raising
+            // SIGPIPE
+            if ((events[i].revents & POLLOUT) != 0)
+            {
+                ssize_t count = send(shard.socket, shard.requests.data() + shard.written,
+                    shard.requests.length() - shard.written, MSG_NOSIGNAL);
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) return false;
+                shard.written += (size_t) count;
+            }
+            if ((events[i].revents & (POLLIN | POLLHUP)) != 0)
+            {
+                ssize_t count = ::read(shard.socket, buffer, sizeof(buffer));
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) return false;
+                shard.responses.append(buffer, (size_t) count);
+                shard.pending -= (size_t) std::count(buffer, buffer + count, '\n');
+            }
+        }
     }
 }
 
 
-bool Node::isCompoundWord(
-    const string &word,
-    set<string> *output ) const
+/**
+ * @brief Clears the queries and responses of every shard for a new round.
+ */
+void main_resetRound(
+    vector<ShardConnection> &shards )
 {
-    return isCompoundWord(word.c_str(), 0, this, output);
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        shards[i].requests.clear();
+        shards[i].written = 0;
+        shards[i].pending = 0;
+        shards[i].responses.clear();
+        shards[i].words.clear();
+    }
 }
 
 
-bool Node::isCompoundWord(
-    const char *value,
-    size_t position,
-    const Node *root,
-    set<string> *output ) const
+/**
+ * @brief Connects to the shard servers given by '--coordinator', checking if the
+ * shard of each address is the expected one. The total number of words in the
+ * shards is stored in @c words.
+ */
+bool main_connectShards(
+    const Options &options,
+    vector<ShardConnection> &shards,
+    size_t &words )
 {
-    bool result = false;
-    char current = value[position];
+    string addresses = options.coordinator;
+    for (size_t start = 0; start <= addresses.length(); )
+    {
+        size_t end = addresses.find(',', start);
+        if (end == string::npos) end = addresses.length();
 
-    // if we reach the end of the string and the current node is not
-    // the end of a word, the validation must fail
-    if (current == 0)
+        ShardConnection shard;
+        shard.address = addresses.substr(start, end - start);
+        shard.socket = main_connect(shard.address);
+        if (shard.socket < 0)
+        {
+            std::cerr << "Can not connect to the shard '" << shard.address << "'" << std::endl;
+            return false;
+        }
+        shards.push_back(shard);
+        start = end + 1;
+    }
+    if (shards.size() > Alphabet::SIZE)
     {
-        if (output != NULL && isTerminal && word != value) output->insert(word);
-        return isTerminal && word != value;
+        std::cerr << "Too many shards (at most " << Alphabet::SIZE << ")" << std::endl;
+        return false;
     }
 
-    // if we have the corresponding next node, we try to continue
-    if (next[ current - 97 ] != NULL)
-        result = next[ current - 97 ]->isCompoundWord(value, position + 1, root, output);
-    // if the previous path failed and we are at the end of a word, we must try find
-    // the next subword from the root
-    if (isTerminal && !result)
+    main_resetRound(shards);
+    for (size_t i = 0; i < shards.size(); ++i)
     {
-        #if (DEBUG_PROCESS == 1)
-        std::cout << "From root looking for " << current << std::endl;
-        #endif
-        result = root->isCompoundWord(value, position, root, output);
+        shards[i].requests = "shard\nwords\n";
+        shards[i].pending = 2;
+    }
+    if (!main_exchange(shards))
+    {
+        std::cerr << "Can not query the shards" << std::endl;
+        return false;
+    }
+    words = 0;
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        std::ostringstream expected;
+        expected << i << '/' << shards.size();
+        std::istringstream responses(shards[i].responses);
+        string shard;
+        size_t count = 0;
+        if (!std::getline(responses, shard) || shard != expected.str() || !(responses >> count))
+        {
+            std::cerr << "The server '" << shards[i].address << "' is not the shard " << i << "/" <<
+                shards.size() << std::endl;
+            return false;
+        }
+        words += count;
     }
+    return true;
+}
 
-    if (output != NULL && isTerminal) output->insert(word);
 
-    return result;
+/**
+ * @brief Segments a word (as @c Graph::segment) given the sub-words found in it
+ * by the shards, ordered by position. In @c origin (with room for
+ * @c length + 1 positions) is stored where the last sub-word of a valid split
+ * of each prefix starts.
+ */
+bool main_segmentMatches(
+    size_t length,
+    const vector<Span> &matches,
+    vector<uint32_t> &origin )
+{
+    static const uint32_t UNKNOWN = 0xFFFFFFFF;
+
+    origin.assign(length + 1, UNKNOWN);
+    origin[0] = 0;
+    for (size_t i = 0; i < matches.size() && origin[length] == UNKNOWN; ++i)
+    {
+        size_t start = matches[i].offset;
+        size_t end = start + matches[i].length;
+        // the word itself is not a valid sub-word
+        if (origin[start] != UNKNOWN && origin[end] == UNKNOWN && (start > 0 || end < length))
+            origin[end] = (uint32_t) start;
+    }
+    return origin[length] != UNKNOWN;
 }
 
 
-vector<string> *main_loadWords(
-    const string &fileName )
+/**
+ * @brief Orders the sub-words found in a word by position (and then by length).
+ */
+bool main_compareSpans(
+    const Span &first,
+    const Span &second )
+{
+    if (first.offset != second.offset) return first.offset < second.offset;
+    return first.length < second.length;
+}
+
+
+/**
+ * @brief Finds the compound words of the input file querying the shard servers.
+ *
+ * The words are read in rounds of a few thousand words. Each word is sent (in
+ * a 'find' query) to every shard owning some of its characters, so the shards
+ * return every sub-word in it, and the word is segmented by the coordinator.
+ */
+int main_coordinate(
+    const Options &options )
 {
-    vector<string> *words = NULL;
+    static const size_t ROUND = 4096;
+
+    Statistics statistics;
+    vector<ShardConnection> shards;
+    size_t words;
+    if (!main_connectShards(options, shards, words))
+    {
+        for (size_t i = 0; i < shards.size(); ++i)
+            ::close(shards[i].socket);
+        return 1;
+    }
+
+    WordReader reader;
+    if (!reader.open(options.inputFile))
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return 1;
+    }
+
+    bool piped = (options.outputFile != NULL && string(options.outputFile) == "-");
+    ostream &report = piped ? std::cerr : std::cout;
+    report << "Loaded " << words << " words" << std::endl << std::endl;
+    OutputWriter *output = main_openOutput(options);
 
-    ifstream input(fileName.c_str());
-    if (input.is_open())
+    Timer timer;
+    vector<string> round;
+    vector< vector<Span> > matches;
+    vector<uint32_t> origin;
+    vector<bool> owners(shards.size());
+    string longest;
+    vector<Span> longestParts;
+    bool failed = false;
+    bool finished = false;
+
+    while (!finished)
     {
-        char line[128];
-        words = new vector<string>();
+        // reads the words of the round and sends them to the shards
+        round.clear();
+        main_resetRound(shards);
+        const char *data;
+        size_t length;
+        while (round.size() < ROUND)
+        {
+            if (!reader.next(data, length))
+            {
+                finished = true;
+                break;
+            }
+
+            size_t index = round.size();
+            round.push_back(string(data, length));
 
-        while (input.good())
+            owners.assign(shards.size(), false);
+            for (size_t i = 0; i < length; ++i)
+                owners[ main_shardOf(Alphabet::symbol((unsigned char) data[i]), shards.size()) ] = true;
+            for (size_t i = 0; i < shards.size(); ++i)
+            {
+                if (!owners[i]) continue;
+                shards[i].requests.append("find ").append(data, length).append(1, '\n');
+                shards[i].words.push_back(index);
+                ++shards[i].pending;
+            }
+        }
+        if (round.empty()) break;
+        if (!main_exchange(shards))
         {
-            input.getline(line, sizeof(line));
-            // skips empty lines
-            if (strlen(line) == 0) continue;
+            std::cerr << "Can not query the shards" << std::endl;
+            failed = true;
+            break;
+        }
 
-            // clean and validates the current line
-            for (size_t i = 0, t = strlen(line); i < t; ++i)
+        // 'position:length' pairs of the sub-words found by each shard
+        matches.assign(round.size(), vector<Span>());
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            std::istringstream responses(shards[i].responses);
+            string line;
+            for (size_t j = 0; j < shards[i].words.size() && std::getline(responses, line); ++j)
             {
-                if (!IS_VALID(line[i])) continue;
+                vector<Span> &found = matches[ shards[i].words[j] ];
+                std::istringstream input(line);
+                Span span;
+                char colon;
+                while (input >> span.offset >> colon >> span.length) found.push_back(span);
+            }
+        }
+
+        for (size_t i = 0; i < round.size(); ++i)
+        {
+            const string &word = round[i];
+            ++statistics.checked;
+            std::sort(matches[i].begin(), matches[i].end(), main_compareSpans);
+            if (!main_segmentMatches(word.length(), matches[i], origin)) continue;
 
-                if (line[i] < 'a')
-                    line[i] += 32;
-                if (line[i] == '\r' || line[i] == '\n')
+            ++statistics.compounds;
+            if (output != NULL) output->writeLine(word.c_str(), word.length());
+            // checks if the current word is the longest until now
+            if (word.length() > longest.length())
+            {
+                longest = word;
+                longestParts.clear();
+                for (size_t end = word.length(); end > 0; end = origin[end])
                 {
-                    line[i] = 0;
-                    break;
+                    Span part = { origin[end], (uint32_t) (end - origin[end]) };
+                    longestParts.insert(longestParts.begin(), part);
                 }
             }
-
-            words->push_back(line);
         }
-        // ensures the word list is sorted
-        std::sort(words->begin(), words->end());
     }
+    statistics.scan = timer.elapsed();
+    statistics.words = statistics.checked;
+    statistics.discarded = reader.discardedCount();
 
+    for (size_t i = 0; i < shards.size(); ++i)
+        ::close(shards[i].socket);
 
-    return words;
+    timer.reset();
+    if (output != NULL && !output->close())
+        std::cerr << "Can not write the compound words to '" << options.outputFile << "'" << std::endl;
+    statistics.write = timer.elapsed();
+    delete output;
+
+    if (failed) return 1;
+    if (reader.failed())
+    {
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
+        return 1;
+    }
+
+    main_printLongest(report, longest, longestParts);
+    main_printTimes(report, statistics);
+    if (options.stats != 0) main_printStatistics(statistics, options.stats == 2);
+    return 0;
 }
 
 
+/**
+ * @brief Answers queries using the given graph.
+ */
+int main_serve(
+    const Options &options,
+    Graph &root )
+{
+    Session session(root);
+    if (options.shards != 0)
+    {
+        std::ostringstream shard;
+        shard << options.shard << '/' << options.shards;
+        session.shard = shard.str();
+        // a shard only has part of the dictionary, so its compound words
+        // would not be the ones of the dictionary
+        session.editable = false;
+    }
+    if (options.port != 0) return main_listen(session, options.port);
+    main_interactive(session);
+    return 0;
+}
+
 
 int main( int argc, char **argv )
 {
-    if (argc != 2 && argc != 3)
+    Options options;
+    if (!main_parseOptions(argc, argv, options))
     {
-        std::cerr << "Usage: quiz <input> [ <output> ]\n\n"
-            "<input>   File containing the words. Only ASCII characters accepted (words\n"
-            "          with non-ASCII characters will be ignored).\n"
-            "<output>  Optional output file where the program could save the list of all\n"
-            "          words which are concatenations of other sub-words that exist in the\n"
-            "          input file.\n\n";
+        main_usage();
         return 1;
     }
 
-    clock_t dataTime = clock();
+    if (options.benchmark != NULL) return main_benchmark(options);
+    if (options.coordinator != NULL) return main_coordinate(options);
+
+    Statistics statistics;
+    statistics.threads = options.threads;
+
+    // loads a graph created previously
+    Timer timer;
+    Graph root;
+    if (options.loadIndex != NULL)
+    {
+        if (!root.load(options.loadIndex))
+        {
+            std::cerr << "Can not load the graph from '" << options.loadIndex << "'" << std::endl;
+            return 1;
+        }
+        statistics.build = timer.elapsed();
+    }
+
+    bool serving = options.interactive || options.port != 0;
+
+    // includes the words in the graph while reading the input file
+    if (options.stream)
+    {
+        if (options.loadIndex == NULL)
+        {
+            if (!main_streamBuild(options, root, statistics)) return 1;
+            bool piped = (options.outputFile != NULL && string(options.outputFile) == "-");
+            if (!serving)
+                (piped ? std::cerr : std::cout) << "Loaded " << statistics.words << " words" << std::endl << std::endl;
+        }
+        if (!main_buildExtras(options, root, statistics)) return 1;
+        statistics.nodes = root.size();
+        statistics.memory = root.memory();
+
+        if (options.saveIndex != NULL && !root.save(options.saveIndex))
+            std::cerr << "Can not save the graph to '" << options.saveIndex << "'" << std::endl;
+
+        if (serving) return main_serve(options, root);
+        return main_streamScan(options, root, statistics);
+    }
+
+    // without input file, the words of a loaded graph are checked walking it
+    bool graphWords = options.inputFile == NULL || string(options.inputFile) == "-";
+    if (options.loadIndex != NULL && graphWords && options.longest == 0 && !serving)
+    {
+        statistics.nodes = root.size();
+        statistics.memory = root.memory();
+        return main_walkScan(options, root, statistics);
+    }
+
+    // loads words from input file (or from the graph itself, which is not
+    // needed when answering queries)
+    WordList *words = NULL;
+    if (options.pipeline)
+    {
+        words = main_loadPipelined(options, root, statistics);
+        if (words == NULL) return 1;
+    }
+    else
+    if (options.loadIndex == NULL || !graphWords)
+        words = main_loadWords(options.inputFile, statistics);
+    else
+    {
+        timer.reset();
+        string text;
+        if (!serving) root.enumerate(text);
+        words = new WordList();
+        words->assign(text);
+        statistics.read = timer.elapsed();
 
-    // loads words from input file
-    vector<string> *words = main_loadWords(argv[1]);
+        timer.reset();
+        words->split();
+        statistics.normalize = timer.elapsed();
+        statistics.words = words->size();
+    }
     if (words == NULL)
     {
-        std::cerr << "Can not load words from '" << argv[1] << "'" << std::endl;
+        std::cerr << "Can not load words from '" << options.inputFile << "'" << std::endl;
         return 1;
     }
-    std::cout << "Loaded " << words->size() << " words" << std::endl << std::endl;
+    if (options.compact)
+    {
+        timer.reset();
+        words->compress();
+        Timing elapsed = timer.elapsed();
+        statistics.sort.wall += elapsed.wall;
+        statistics.sort.cpu += elapsed.cpu;
+    }
+    statistics.wordMemory = words->memory();
+    // when the compound words go to the standard output, the messages don't
+    bool piped = (options.outputFile != NULL && string(options.outputFile) == "-");
+    if (!serving || options.loadIndex == NULL)
+        (piped ? std::cerr : std::cout) << "Loaded " << words->size() << " words" << std::endl << std::endl;
 
-    dataTime = (clock() - dataTime) / (CLOCKS_PER_SEC / 1000);
+    // creates the graph parsing each word
+    if (options.loadIndex == NULL && !options.pipeline)
+    {
+        uint32_t first;
+        uint32_t last;
+        main_shardSymbols(options, first, last);
+        timer.reset();
+        main_build(root, *words, options.dawg, options.threads, first, last);
+        statistics.build = timer.elapsed();
+    }
+    if (!main_buildExtras(options, root, statistics))
+    {
+        delete words;
+        return 1;
+    }
+    statistics.nodes = root.size();
+    statistics.memory = root.memory();
 
+    if (options.saveIndex != NULL && !root.save(options.saveIndex))
+        std::cerr << "Can not save the graph to '" << options.saveIndex << "'" << std::endl;
 
-    clock_t processTime = clock();
+    // the graph is ready, so we can answer queries
+    if (serving)
+    {
+        delete words;
+        return main_serve(options, root);
+    }
 
-    // creates the graph parsing each word
-    Node root;
-    vector<string>::iterator first = words->begin();
-    vector<string>::iterator last = words->end();
-    for (; first != last; ++first)
+    // the word list is not needed to walk the graph
+    if (options.walk)
     {
-        root.parse(*first);
+        delete words;
+        return main_walkScan(options, root, statistics);
     }
 
     // checks if the user wants to save the list of compound words
-    ofstream *output = NULL;
-    if (argc == 3)
+    OutputWriter *output = main_openOutput(options);
+
+    // processes all words in order to discover which ones are compound
+    timer.reset();
+    vector<ScanResult> results;
+    Profile profile(options.profile);
+    Profile *profiling = (options.profile != 0) ? &profile : NULL;
+    if (options.longest > 0)
     {
-        output = new ofstream(argv[2]);
-        if (!output->is_open())
-        {
-            delete output;
-            output = NULL;
-        }
+        results.resize(1);
+        main_scanLongest(root, *words, options.longest, options.threads, results[0],
+            &statistics.workers, profiling);
     }
+    else
+        main_scan(root, *words, NULL, 0, words->size(), options.threads, results,
+            &statistics.workers, profiling);
+    statistics.scan = timer.elapsed();
 
-    // processes all words in order to discover which ones are compound
+    timer.reset();
     string longest;
     size_t length = 0;
-    first = words->begin();
-    last = words->end();
-    for (; first != last; ++first)
+    if (output != NULL) main_writeCompounds(*output, *words, results);
+    for (size_t i = 0; i < results.size(); ++i)
     {
-        // the current word is composed of other words in the list?
-        if (root.isCompoundWord(*first, NULL))
+        const ScanResult &result = results[i];
+
+        // the first longest word wins, as in a sequential scan
+        if (result.compounds.size() > 0 && words->length(result.longest) > length)
         {
-            if (output != NULL)
-                (*output) << *first << std::endl;
-            // checks if the current word is the longest until now
-            if ((*first).length() > length)
-            {
-                longest = *first;
-                length = (*first).length();
-            }
+            longest = words->word(result.longest);
+            length = longest.length();
         }
+
+        statistics.checked += result.checked;
+        statistics.compounds += result.compounds.size();
+        statistics.counters += result.counters;
     }
+    if (output != NULL && !output->close())
+        std::cerr << "Can not write the compound words to '" << options.outputFile << "'" << std::endl;
+    statistics.write = timer.elapsed();
 
-    processTime = (clock() - processTime) / (CLOCKS_PER_SEC / 1000);
+    ostream &report = piped ? std::cerr : std::cout;
 
     // prints the result
-    std::cout << std::endl << "The longest compound word is '" << longest << "'" << std::endl << std::endl;
-    std::cout << "Sub-words of '" << longest << "':" << std::endl << "    ";
-    set<string> subWords;
-    root.isCompoundWord(longest, &subWords);
-    set<string>::iterator it = subWords.begin();
-    for (; it != subWords.end(); ++it)
-        std::cout << *it << ' ';
-    std::cout << std::endl;
+    main_printLongest(report, root, longest);
+
+    if (options.longest > 1)
+    {
+        const vector<size_t> &compounds = results[0].compounds;
+        report << std::endl << "The " << compounds.size() << " longest compound words:" << std::endl;
+        for (size_t i = 0; i < compounds.size(); ++i)
+            report << "    " << words->word(compounds[i]) << std::endl;
+    }
 
     // prints additional information
-    std::cout << std::endl;
-    std::cout << "Preparation time: " << dataTime << " ms" << std::endl;
-    std::cout << " Processing time: " << processTime << " ms" << std::endl;
+    main_printTimes(report, statistics);
+
+    if (options.stats != 0) main_printStatistics(statistics, options.stats == 2);
+    if (options.profile != 0) main_printProfile(profile, options.stats == 2);
 
     if (words != NULL) delete words;
-    if (output != NULL)
-    {
-        output->close();
-        delete output;
-    }
+    if (output != NULL) delete output;
 }